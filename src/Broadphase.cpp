@@ -0,0 +1,120 @@
+#include "Broadphase.hpp"
+#include "math/Trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+/// Pack signed cell coordinates into a single key, 21 bits per axis
+static uint64_t cellKey(int64_t x, int64_t y, int64_t z) {
+    constexpr uint64_t mask = (uint64_t{1} << 21) - 1;
+    return ((static_cast<uint64_t>(x) & mask) << 42) | ((static_cast<uint64_t>(y) & mask) << 21) | (static_cast<uint64_t>(z) & mask);
+}
+//---------------------------------------------------------------------------
+void Broadphase::clear() {
+    centers.clear();
+    radii.clear();
+}
+//---------------------------------------------------------------------------
+unsigned Broadphase::add(const Vec3& center, num radius) {
+    centers.push_back(center);
+    radii.push_back(radius);
+    return static_cast<unsigned>(centers.size() - 1);
+}
+//---------------------------------------------------------------------------
+bool Broadphase::overlaps(unsigned a, unsigned b) const
+// Check if the bounding boxes of two spheres overlap
+{
+    auto d = centers[a] - centers[b];
+    auto r = radii[a] + radii[b] + epsilon;
+    return abs(d.x) <= r && abs(d.y) <= r && abs(d.z) <= r;
+}
+//---------------------------------------------------------------------------
+std::span<const Broadphase::Pair> Broadphase::findPairs()
+// Find all pairs of spheres with overlapping bounds
+{
+    math::TraceScope trace("findPairs");
+    pairs.clear();
+    auto n = static_cast<unsigned>(centers.size());
+    if (n < 2)
+        return pairs;
+
+    // Cells are as large as the largest sphere, so overlapping spheres are in neighboring cells
+    num cellSize = 2 * *max_element(radii.begin(), radii.end()) + epsilon;
+    num invCellSize = 1 / cellSize;
+    auto cellOf = [&](num v) { return static_cast<int64_t>(floor(v * invCellSize)); };
+
+    entries.resize(n);
+    for (unsigned i = 0; i < n; i++)
+        entries[i] = {cellKey(cellOf(centers[i].x), cellOf(centers[i].y), cellOf(centers[i].z)), i};
+    ranges::sort(entries, [](const Entry& a, const Entry& b) { return a.cell < b.cell || (a.cell == b.cell && a.index < b.index); });
+
+    cells.clear();
+    for (unsigned begin = 0; begin < n;) {
+        auto end = begin + 1;
+        while (end < n && entries[end].cell == entries[begin].cell)
+            end++;
+        cells.push_back({entries[begin].cell, begin, end});
+        begin = end;
+    }
+
+    auto addPair = [&](unsigned a, unsigned b) {
+        if (overlaps(a, b))
+            pairs.push_back({min(a, b), max(a, b)});
+    };
+    for (auto& [key, begin, end] : cells) {
+        for (auto i = begin; i < end; i++)
+            for (auto j = i + 1; j < end; j++)
+                addPair(entries[i].index, entries[j].index);
+
+        // Each pair of neighboring cells is visited once, from the cell with the smaller offset
+        auto& c = centers[entries[begin].index];
+        auto x = cellOf(c.x), y = cellOf(c.y), z = cellOf(c.z);
+        for (int dx = 0; dx <= 1; dx++) {
+            for (int dy = dx ? -1 : 0; dy <= 1; dy++) {
+                for (int dz = (dx || dy) ? -1 : 1; dz <= 1; dz++) {
+                    auto neighbor = cellKey(x + dx, y + dy, z + dz);
+                    auto it = ranges::lower_bound(cells, neighbor, {}, &Cell::key);
+                    if (it == cells.end() || it->key != neighbor)
+                        continue;
+                    auto [nkey, nbegin, nend] = *it;
+                    for (auto i = begin; i < end; i++)
+                        for (auto j = nbegin; j < nend; j++)
+                            addPair(entries[i].index, entries[j].index);
+                }
+            }
+        }
+    }
+    return pairs;
+}
+//---------------------------------------------------------------------------
+TEST_CASE("Broadphase") {
+    Broadphase broadphase;
+    // A row of touching spheres and one far away
+    for (unsigned i = 0; i < 10; i++)
+        broadphase.add({i * num(0.5), 0.0, i * num(-0.1)}, 0.3);
+    broadphase.add({100.0, 100.0, 100.0}, 0.2);
+    auto pairs = broadphase.findPairs();
+
+    // Compare against all pairs
+    vector<pair<unsigned, unsigned>> found, expected;
+    for (auto& p : pairs)
+        found.emplace_back(p.a, p.b);
+    for (unsigned a = 0; a < 11; a++)
+        for (unsigned b = a + 1; b < 11; b++) {
+            Vec3 ca{a * num(0.5), 0.0, a * num(-0.1)}, cb{b * num(0.5), 0.0, b * num(-0.1)};
+            if (a < 10 && b < 10 && abs(ca.x - cb.x) <= 0.6 && abs(ca.z - cb.z) <= 0.6)
+                expected.emplace_back(a, b);
+        }
+    ranges::sort(found);
+    REQUIRE(found == expected);
+
+    broadphase.clear();
+    REQUIRE(broadphase.findPairs().empty());
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
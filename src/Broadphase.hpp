@@ -0,0 +1,54 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "Vec3.hpp"
+#include "math/Num.hpp"
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+/// Uniform grid spatial hash over sphere bounds, finds pairs of spheres that may collide
+class Broadphase {
+    public:
+    /// Indices of two spheres with overlapping bounds, a < b
+    struct Pair {
+        unsigned a;
+        unsigned b;
+    };
+
+    private:
+    struct Entry {
+        uint64_t cell;
+        unsigned index;
+    };
+    std::vector<Vec3> centers;
+    std::vector<num> radii;
+    /// Spheres sorted by cell
+    std::vector<Entry> entries;
+    /// Range in entries of each occupied cell
+    struct Cell {
+        uint64_t key;
+        unsigned begin;
+        unsigned end;
+    };
+    /// Sorted by key, a sorted array instead of a hash map so that steady state frames do not allocate
+    std::vector<Cell> cells;
+    std::vector<Pair> pairs;
+
+    bool overlaps(unsigned a, unsigned b) const;
+
+    public:
+    /// Remove all spheres, keeps the allocated memory
+    void clear();
+    /// Add a sphere, returns its index
+    unsigned add(const Vec3& center, num radius);
+    /// Number of spheres
+    size_t size() const { return centers.size(); }
+    /// Find all pairs of spheres with overlapping bounds. Valid until the next call
+    std::span<const Pair> findPairs();
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
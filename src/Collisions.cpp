@@ -0,0 +1,132 @@
+#include "Collisions.hpp"
+#include "math/Physics.hpp"
+#include "math/Stats.hpp"
+#include "math/Trace.hpp"
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+void Collisions::clear() {
+    spheres.clear();
+    planes.clear();
+}
+//---------------------------------------------------------------------------
+size_t Collisions::addContacts(math::Physics& world)
+// Planes are tested against every awake dynamic sphere, sphere pairs come from the broadphase. The contacts of sleeping spheres are kept from the last call
+{
+    math::TraceScope trace("addContacts");
+    auto xs = world.xs();
+    auto center = [&](const Sphere& s) {
+        return s.dynamic ? Vec3{xs[s.offset], xs[s.offset + 1], xs[s.offset + 2]} : s.x;
+    };
+    auto asleep = [&](const Sphere& s) { return s.dynamic && world.isAsleep(s.offset); };
+    world.clearAwakeContacts();
+    auto collidePlane = [&](const Sphere& s1, const Vec3& p1, const Plane& plane) {
+        auto height = (plane.up * plane.x).sum() + s1.radius;
+        if ((p1 * plane.up).sum() > height + epsilon)
+            return;
+        world.addContact(math::Constraint::getPlaneCollision1(), {s1.offset, s1.offset + 1, s1.offset + 2}, {plane.up.x, plane.up.y, plane.up.z, height});
+    };
+    auto collideStatic = [&](const Sphere& s1, const Vec3& p1, const Sphere& s2) {
+        auto dist = (s1.radius + s2.radius);
+        if ((p1 - s2.x).sqrlen() > dist * dist + epsilon)
+            return;
+        world.addContact(math::Constraint::getSphereCollision1(), {s1.offset, s1.offset + 1, s1.offset + 2}, {s2.x.x, s2.x.y, s2.x.z, dist});
+    };
+    auto collideDynamic = [&](const Sphere& s1, const Vec3& p1, const Sphere& s2, const Vec3& p2) {
+        auto dist = (s1.radius + s2.radius);
+        if ((p1 - p2).sqrlen() > dist * dist + epsilon)
+            return;
+        world.addContact(math::Constraint::getSphereCollision2(), {s1.offset, s1.offset + 1, s1.offset + 2, s2.offset, s2.offset + 1, s2.offset + 2}, {dist});
+    };
+
+    broadphase.clear();
+    for (auto& sphere : spheres)
+        broadphase.add(center(sphere), sphere.radius);
+    for (auto& sphere : spheres)
+        if (sphere.dynamic && !asleep(sphere))
+            for (auto& plane : planes)
+                collidePlane(sphere, center(sphere), plane);
+    for (auto [a, b] : broadphase.findPairs()) {
+        auto& s1 = spheres[a];
+        auto& s2 = spheres[b];
+        // A sleeping sphere next to a static one or another sleeping sphere still has its contact
+        if ((asleep(s1) || !s1.dynamic) && (asleep(s2) || !s2.dynamic))
+            continue;
+        if (s1.dynamic && s2.dynamic) {
+            collideDynamic(s1, center(s1), s2, center(s2));
+        } else if (s1.dynamic) {
+            collideStatic(s1, center(s1), s2);
+        } else if (s2.dynamic) {
+            collideStatic(s2, center(s2), s1);
+        }
+    }
+    return world.numContacts();
+}
+//---------------------------------------------------------------------------
+TEST_CASE("Collisions") {
+    math::Physics world;
+    num x0[] = {0.0, 0.1, 0.0}, x1[] = {0.3, 0.1, 0.0}, x2[] = {5.0, 5.0, 5.0}, v[] = {0.0, 0.0, 0.0}, m[] = {1.0, 1.0, 1.0};
+    auto a = world.addComponents(x0, v, m);
+    auto b = world.addComponents(x1, v, m);
+    auto c = world.addComponents(x2, v, m);
+
+    // Two touching spheres on the ground, one far away next to a static sphere
+    Collisions collisions;
+    collisions.addParticle(a, 0.2);
+    collisions.addParticle(b, 0.2);
+    collisions.addParticle(c, 0.2);
+    collisions.addSphere({5.0, 5.3, 5.0}, 0.2);
+    collisions.addPlane({}, {0.0, 1.0, 0.0});
+    REQUIRE(collisions.addContacts(world) == 4);
+    REQUIRE(world.numConstraints() == 4);
+
+    // Contacts are replaced, not added
+    world.xs()[c + 1] = 10.0;
+    REQUIRE(collisions.addContacts(world) == 3);
+    REQUIRE(world.numConstraints() == 3);
+
+    collisions.clear();
+    REQUIRE(collisions.addContacts(world) == 0);
+    REQUIRE(world.numConstraints() == 0);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("Collisions of sleeping spheres") {
+    // Two spheres come to rest on the ground, their contacts are kept instead of found again
+    using Catch::Approx;
+    math::Physics world;
+    num x0[] = {0.0, 0.2, 0.0}, x1[] = {0.5, 0.2, 0.0}, v[] = {0.0, 0.0, 0.0}, m[] = {1.0, 1.0, 1.0};
+    auto a = world.addComponents(x0, v, m);
+    auto b = world.addComponents(x1, v, m);
+    for (auto offset : {a, b})
+        world.addForce(math::Force::getConstant(), {offset, offset + 1, offset + 2}, {0.0, -10.0, 0.0});
+    Collisions collisions;
+    collisions.addParticle(a, 0.2);
+    collisions.addParticle(b, 0.2);
+    collisions.addPlane({}, {0.0, 1.0, 0.0});
+    for (unsigned i = 0; i < 200; i++) {
+        collisions.addContacts(world);
+        world.step(0.01);
+    }
+    REQUIRE(world.isAsleep(a));
+    REQUIRE(world.isAsleep(b));
+    // The contacts of the sleeping spheres are the same as in the last step, so the pattern stays
+    REQUIRE(collisions.addContacts(world) == 2);
+    world.step(0.01);
+    if constexpr (math::statsEnabled)
+        REQUIRE(world.getStats().seconds.pattern == 0);
+
+    // A woken sphere gets its contact again, the other one keeps sleeping
+    world.wake(b, 3);
+    REQUIRE(collisions.addContacts(world) == 2);
+    REQUIRE(world.isAsleep(a));
+    world.step(0.01);
+    REQUIRE(!world.isAsleep(b));
+    REQUIRE(world.xs()[b + 1] == Approx(0.2).margin(0.01));
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
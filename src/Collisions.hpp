@@ -0,0 +1,49 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "Broadphase.hpp"
+#include "Vec3.hpp"
+#include "math/Num.hpp"
+#include <vector>
+//---------------------------------------------------------------------------
+namespace physman::math {
+class Physics;
+}
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+/// Sphere and plane colliders, turns their overlaps into contacts of a physics world.
+/// Holds copies of the collider data, so that contacts can be found without access to the entities
+class Collisions {
+    public:
+    struct Sphere {
+        /// Center of static spheres, dynamic spheres use the position of their particle
+        Vec3 x;
+        num radius = 0;
+        bool dynamic = false;
+        /// First of the three components of the particle
+        unsigned offset = 0;
+    };
+    /// Static and infinite
+    struct Plane {
+        Vec3 x;
+        /// Normalized
+        Vec3 up = {0.0, 1.0, 0.0};
+    };
+    std::vector<Sphere> spheres;
+    std::vector<Plane> planes;
+
+    private:
+    Broadphase broadphase;
+
+    public:
+    /// Remove all colliders, keeps the allocated memory
+    void clear();
+    void addSphere(const Vec3& x, num radius) { spheres.push_back({x, radius}); }
+    void addParticle(unsigned offset, num radius) { spheres.push_back({{}, radius, true, offset}); }
+    void addPlane(const Vec3& x, const Vec3& up) { planes.push_back({x, up}); }
+    /// Replace the contacts of the world with the overlaps at its current state. Contacts between sleeping spheres are kept instead of found again. Returns the number of contacts
+    size_t addContacts(math::Physics& world);
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -1,8 +1,13 @@
 #include "Game.hpp"
+#include "Renderer.hpp"
+#include "Scene.hpp"
 #include "Vec3.hpp"
-#include "math/Physics.hpp"
+#include "math/Stats.hpp"
+#include "math/Trace.hpp"
 #include <raylib.h>
+#include <algorithm>
 #include <cmath>
+#include <mutex>
 #include <fmt/format.h>
 #include <entt/entity/registry.hpp>
 //---------------------------------------------------------------------------
@@ -12,26 +17,6 @@ namespace physman {
 //---------------------------------------------------------------------------
 Game::~Game() noexcept = default;
 //---------------------------------------------------------------------------
-struct Position {
-    Vec3 x;
-};
-struct Particle {
-    num m;
-    Vec3 v;
-    unsigned offset = 0;
-};
-struct Gravity {};
-struct Force {
-    Vec3 f;
-};
-enum class ColliderType {
-    Sphere, Ground
-};
-struct Collider {
-    ColliderType type = ColliderType::Sphere;
-    num radius = 0.0;
-    Vec3 up = {0.0, 1.0, 0.0};
-};
 struct RenderSphere {
     Color color = {};
     num radius = 0.0;
@@ -41,20 +26,6 @@ struct RenderPlane {
     Vec3 top = {1.0, 0.0, 0.0};
     Vec3 right = {0.0, 0.0, 1.0};
 };
-struct FixConstraint {
-    Vec3 pos;
-};
-struct DistanceConstraint {
-    entt::entity otherEntity{};
-    num distance = 0.0;
-};
-//---------------------------------------------------------------------------
-static void push(Vec& v, const Vec3& val) {
-    v.reserve(v.size() + 3);
-    v.push_back(val.x);
-    v.push_back(val.y);
-    v.push_back(val.z);
-}
 //---------------------------------------------------------------------------
 Vec3::operator Vector3() const {
     return {static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)};
@@ -62,117 +33,100 @@ Vec3::operator Vector3() const {
 //---------------------------------------------------------------------------
 struct GameImpl : Game {
     Camera camera{0};
-    entt::registry registry;
-
-    GameImpl() {
-    }
+    /// The entities and the physics world
+    Scene scene;
+    entt::registry& registry = scene.registry;
+    /// Overlay with the physics stats, toggled with F1
+    bool showStats = false;
+    /// Draws the spheres and constraint lines in batches, F3 switches to drawing them one by one
+    Renderer renderer;
+    bool batchedRendering = true;
+    /// Trace of all threads, F2 starts and stops the recording
+    static constexpr const char* tracePath = "physman-trace.json";
 
     int getScreenWidth() final { return 1024; }
     int getScreenHeight() final { return 768; }
     string getTitle() final { return "physman"; }
 
-    num physicsTime = 0;
-    num physicsStep = 1.0 / 64;
-
-    void updatePhysics(num deltaTime, num totalTime) {
-        auto physView = registry.view<Position, Particle>();
-        Vec xs, vs, ms;
-        size_t szHint = physView.size_hint();
-        xs.reserve(szHint);
-        vs.reserve(szHint);
-        ms.reserve(szHint);
-        physView.each([&](const Position& pos, Particle& part) {
-            part.offset = xs.size();
-            push(xs, pos.x);
-            push(vs, part.v);
-            push(ms, {part.m, part.m, part.m});
-        });
-        size_t numComps = xs.size();
-
-        math::Physics phys(move(xs), move(vs), move(ms), physicsTime);
-
-        auto* constantForce = math::Force::getConstant();
-        num gravitationalConstant = 9.81;
-        registry.view<const Gravity, const Particle>().each([&](const Particle& part) {
-            phys.addForce(constantForce, {part.offset, part.offset + 1, part.offset + 2}, {0.0, -gravitationalConstant * part.m, 0.0});
-        });
-        registry.view<const Force, const Particle>().each([&](const Force& forceComponent, const Particle& part) {
-            phys.addForce(constantForce, {part.offset, part.offset + 1, part.offset + 2}, {forceComponent.f.x, forceComponent.f.y, forceComponent.f.z});
-        });
-        registry.view<const FixConstraint, const Particle>().each([&](const FixConstraint& fix, const Particle& part) {
-            phys.addConstraint(math::Constraint::getFixed(), {part.offset, part.offset + 1, part.offset + 2}, {fix.pos.x, fix.pos.y, fix.pos.z});
-        });
-        registry.view<const Position, const Particle, const DistanceConstraint>().each([&](const Position& pos1, const Particle& part1, const DistanceConstraint& dist) {
-            auto* pos2 = registry.try_get<const Position>(dist.otherEntity);
-            assert(pos2);
-            auto* part2 = registry.try_get<const Particle>(dist.otherEntity);
-            if (part2) {
-                phys.addConstraint(math::Constraint::getDistance2(), {part1.offset, part1.offset + 1, part1.offset + 2, part2->offset, part2->offset + 1, part2->offset + 2}, {dist.distance});
-            } else {
-                phys.addConstraint(math::Constraint::getDistance1(), {part1.offset, part1.offset + 1, part1.offset + 2}, {pos2->x.x, pos2->x.y, pos2->x.z, dist.distance});
-            }
-        });
-
-        auto handleCollide1 = [&](const Position& p1, const Collider& c1, const Particle& part1, const Position& p2, const Collider& c2) {
-            assert(c1.type == ColliderType::Sphere);
-            if (c2.type == ColliderType::Ground) {
-                if ((p1.x * c2.up).sum() > (c2.up * p2.x).sum() + c1.radius + epsilon)
-                    return;
-                phys.addConstraint(math::Constraint::getPlaneCollision1(), {part1.offset, part1.offset + 1, part1.offset + 2}, {c2.up.x, c2.up.y, c2.up.z, (c2.up * p2.x).sum() + c1.radius});
-            } else {
-                auto dist = (c1.radius + c2.radius);
-                if ((p1.x - p2.x).sqrlen() > dist * dist + epsilon)
-                    return;
-                phys.addConstraint(math::Constraint::getSphereCollision1(), {part1.offset, part1.offset + 1, part1.offset + 2}, {p2.x.x, p2.x.y, p2.x.z, c1.radius + c2.radius});
-            }
+    void drawStats()
+    // Work of the last physics step, times in milliseconds
+    {
+        math::PhysicsStats stats;
+        size_t substeps;
+        {
+            lock_guard lock(scene.statsMutex);
+            stats = scene.physicsStats;
+            substeps = scene.physicsSubsteps;
+        }
+        int y = 10;
+        auto line = [&](const string& text) {
+            DrawText(text.c_str(), 10, y, 20, DARKGRAY);
+            y += 22;
         };
-        auto handleCollide2 = [&](const Position& p1, const Collider& c1, const Particle& part1, const Position& p2, const Collider& c2, const Particle& part2) {
-            assert(c1.type == ColliderType::Sphere);
-            assert(c2.type == ColliderType::Sphere);
-            auto dist = (c1.radius + c2.radius);
-            if ((p1.x - p2.x).sqrlen() > dist * dist + epsilon)
-                return;
-            phys.addConstraint(math::Constraint::getSphereCollision2(), {part1.offset, part1.offset + 1, part1.offset + 2, part2.offset, part2.offset + 1, part2.offset + 2}, {c1.radius + c2.radius});
+        auto ms = [](double seconds) { return seconds * 1e3; };
+        auto types = [](string_view title, const vector<math::PhysicsStats::TypeCount>& counts) {
+            string text(title);
+            for (auto& type : counts)
+                text += fmt::format(" {} {}", type.name, type.count);
+            return text;
         };
-
-        auto colliders = registry.view<const Position, const Collider>();
-        colliders.each([&](entt::entity e1, const Position& p1, const Collider& c1) {
-            Particle* part1 = registry.try_get<Particle>(e1);
-            // Axis collider cannot have physics
-            assert(c1.type == ColliderType::Sphere || !part1);
-            colliders.each([&](entt::entity e2, const Position& p2, const Collider& c2) {
-                if (e2 <= e1)
-                    return;
-                Particle* part2 = registry.try_get<Particle>(e2);
-                if (part1 && part2) {
-                    handleCollide2(p1, c1, *part1, p2, c2, *part2);
-                } else if (part1) {
-                    handleCollide1(p1, c1, *part1, p2, c2);
-                } else if (part2) {
-                    handleCollide1(p2, c2, *part2, p1, c1);
-                }
-            });
-        });
-
-        size_t substeps = 1;
-        for (size_t i = 0; i < substeps; i++)
-            phys.step(physicsStep / substeps);
-        physicsTime += physicsStep;
-        physView.each([&](Position& pos, Particle& part) {
-            pos.x = {phys.state[part.offset], phys.state[part.offset + 1], phys.state[part.offset + 2]};
-            part.v = {phys.state[numComps + part.offset], phys.state[numComps + part.offset + 1], phys.state[numComps + part.offset + 2]};
-        });
+        line(fmt::format("{} fps, physics step {:.2f} ms, {} substeps", GetFPS(), ms(stats.seconds.total), substeps));
+        if (!math::statsEnabled) {
+            line("built without PHYSMAN_STATS");
+            return;
+        }
+        auto& s = stats.seconds;
+        line(fmt::format("pattern {:.2f} forces {:.2f} constraints {:.2f} rhs {:.2f} solve {:.2f} (products {:.2f} preconditioner {:.2f}) sleep {:.2f}",
+                         ms(s.pattern), ms(s.forces), ms(s.constraints), ms(s.rhs), ms(s.solve), ms(s.solveProducts), ms(s.solvePreconditioner), ms(s.sleep)));
+        line(fmt::format("CG {} solves, {} iterations, {} unconverged, max residual {:.1e}", stats.solves, stats.cgIterations, stats.unconverged, stats.maxResidual));
+        string stages = "CG iterations per stage:";
+        for (auto& stage : stats.stages)
+            stages += fmt::format(" {}", stage.cgIterations);
+        line(stages);
+        line(fmt::format("J {} nonzeros, {} allocations, arena {:.1f} KiB, peak {:.1f} KiB", stats.nonzeros, stats.allocations, stats.arenaBytes / 1024.0, stats.arenaPeak / 1024.0));
+        line(types("constraints:", stats.constraints));
+        line(types("contacts:", stats.contacts));
+        line(types("forces:", stats.forces));
+        if (batchedRendering) {
+            auto& r = renderer.getStats();
+            line(fmt::format("render {} spheres ({} coarse, {} culled), {} lines ({} culled), {} draw calls", r.spheres, r.coarseSpheres, r.culledSpheres, r.lines, r.culledLines, r.drawCalls));
+        } else {
+            line("render one by one (F3)");
+        }
     }
 
     void draw(num deltaTime, num totalTime) final {
+        math::TraceScope trace("draw");
+        scene.interpolatePhysics();
         ClearBackground(RAYWHITE);
 
         BeginMode3D(camera);
 
-        registry.view<const RenderSphere, const Position>().each([&](const RenderSphere& sphere, const Position& position) {
-            DrawSphere(position.x, sphere.radius, sphere.color);
-            DrawSphereWires(position.x, sphere.radius, 16, 16, BLACK);
-        });
+        // Simulated particles are drawn at their interpolated position
+        auto& positions = registry.storage<Position>();
+        auto& shownPositions = registry.storage<RenderPosition>();
+        auto shown = [&](entt::entity e) { return shownPositions.contains(e) ? shownPositions.get(e).x : positions.get(e).x; };
+        if (batchedRendering) {
+            renderer.begin(camera, static_cast<num>(GetScreenWidth()) / GetScreenHeight());
+            registry.view<const RenderSphere, const Position>().each([&](entt::entity e, const RenderSphere& sphere, const Position&) {
+                renderer.addSphere(shown(e), sphere.radius, sphere.color);
+            });
+            registry.view<const Position, const DistanceConstraint>().each([&](entt::entity e, const Position&, const DistanceConstraint& dc) {
+                if (positions.contains(dc.otherEntity))
+                    renderer.addLine(shown(e), shown(dc.otherEntity), BLACK);
+            });
+            renderer.draw();
+        } else {
+            registry.view<const RenderSphere, const Position>().each([&](entt::entity e, const RenderSphere& sphere, const Position&) {
+                auto x = shown(e);
+                DrawSphere(x, sphere.radius, sphere.color);
+                DrawSphereWires(x, sphere.radius, 16, 16, BLACK);
+            });
+            registry.view<const Position, const DistanceConstraint>().each([&](entt::entity e, const Position&, const DistanceConstraint& dc) {
+                if (positions.contains(dc.otherEntity))
+                    DrawLine3D(shown(e), shown(dc.otherEntity), BLACK);
+            });
+        }
         registry.view<const RenderPlane, const Position>().each([&](const RenderPlane& ground, const Position& position) {
             auto v1 = position.x - ground.top - ground.right;
             auto v2 = position.x - ground.top + ground.right;
@@ -181,12 +135,13 @@ struct GameImpl : Game {
             DrawTriangle3D(v1, v2, v3, ground.color);
             DrawTriangle3D(v3, v4, v1, ground.color);
         });
-        registry.view<const Position, const DistanceConstraint>().each([&](const Position& pos, const DistanceConstraint& dc) {
-            auto& pos2 = registry.get<const Position>(dc.otherEntity);
-            DrawLine3D(pos.x, pos2.x, BLACK);
-        });
 
         EndMode3D();
+
+        if (showStats)
+            drawStats();
+        if (math::Trace::isRecording())
+            DrawText(fmt::format("recording {} (F2)", tracePath).c_str(), 10, GetScreenHeight() - 30, 20, RED);
     }
 
     void init() final {
@@ -274,6 +229,16 @@ struct GameImpl : Game {
                             0.0f // Rotation: roll
                         },
                         GetMouseWheelMove()*2.0f); // Move to target (zoom)
+        if (IsKeyPressed(KEY_F1))
+            showStats = !showStats;
+        if (IsKeyPressed(KEY_F2)) {
+            if (!math::Trace::isRecording())
+                math::Trace::start();
+            else if (!math::Trace::stop(tracePath))
+                TraceLog(LOG_WARNING, "could not write %s", tracePath);
+        }
+        if (IsKeyPressed(KEY_F3))
+            batchedRendering = !batchedRendering;
 
         if (totalTime < 1.0)
             return;
@@ -291,7 +256,7 @@ struct GameImpl : Game {
         }
         spaceup = !IsKeyDown(KEY_SPACE);
 
-        updatePhysics(deltaTime, totalTime);
+        scene.updatePhysics(totalTime);
     }
 };
 //---------------------------------------------------------------------------
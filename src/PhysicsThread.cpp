@@ -0,0 +1,166 @@
+#include "PhysicsThread.hpp"
+#include "math/Trace.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+PhysicsThread::PhysicsThread(num step, Step stepFunction, bool threaded)
+    : step(step), stepFunction(std::move(stepFunction)) {
+    assert(step > 0);
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    // Built without thread support
+    threaded = false;
+#endif
+    if (threaded && thread::hardware_concurrency() > 1)
+        thread = std::thread([this] { run(); });
+}
+//---------------------------------------------------------------------------
+PhysicsThread::~PhysicsThread() noexcept {
+    if (!thread.joinable())
+        return;
+    {
+        lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+//---------------------------------------------------------------------------
+unique_lock<mutex> PhysicsThread::lockWorld() {
+    unique_lock lock(worldMutex);
+    edits++;
+    return lock;
+}
+//---------------------------------------------------------------------------
+void PhysicsThread::run() {
+    math::Trace::nameThread("physics");
+    while (true) {
+        {
+            unique_lock lock(mutex);
+            wake.wait(lock, [&] { return stopping || time + step <= target; });
+            if (stopping)
+                return;
+        }
+        advance();
+    }
+}
+//---------------------------------------------------------------------------
+void PhysicsThread::advance()
+// Step into the back buffer, then rotate it to the front
+{
+    while (true) {
+        num t;
+        {
+            lock_guard lock(mutex);
+            if (stopping || time + step > target) {
+                caughtUp.notify_all();
+                return;
+            }
+            time = max(time, target - maxLag);
+            t = time + step;
+        }
+        auto& snapshot = snapshots[back];
+        {
+            lock_guard lock(worldMutex);
+            stepFunction(step, snapshot);
+            snapshot.edits = edits;
+        }
+        snapshot.t = t;
+        {
+            lock_guard lock(snapshotMutex);
+            auto oldPrevious = previous;
+            previous = latest;
+            latest = back;
+            back = oldPrevious;
+            published = min(published + 1, 2u);
+        }
+        lock_guard lock(mutex);
+        time = t;
+    }
+}
+//---------------------------------------------------------------------------
+void PhysicsThread::advanceTo(num t) {
+    {
+        lock_guard lock(mutex);
+        // The simulation starts at the first target
+        if (isnan(time))
+            time = t;
+        target = max(target, t);
+        renderTime = target - step;
+    }
+    if (isThreaded())
+        wake.notify_one();
+    else
+        advance();
+}
+//---------------------------------------------------------------------------
+void PhysicsThread::wait() {
+    unique_lock lock(mutex);
+    caughtUp.wait(lock, [&] { return !isThreaded() || stopping || time + step > target; });
+}
+//---------------------------------------------------------------------------
+void PhysicsThread::read(Reader reader) {
+    lock_guard lock(snapshotMutex);
+    if (!published)
+        return;
+    auto& a = snapshots[published > 1 ? previous : latest];
+    auto& b = snapshots[latest];
+    num alpha = b.t > a.t ? clamp((renderTime - a.t) / (b.t - a.t), num(0), num(1)) : num(1);
+    reader(a, b, alpha);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("PhysicsThread") {
+    using Catch::Approx;
+    // A point moving with unit speed, the state is its position
+    for (bool threaded : {false, true}) {
+        num x = 0;
+        size_t steps = 0;
+        num step = 1.0 / 16;
+        PhysicsThread physics(step, [&](num h, PhysicsThread::Snapshot& snapshot) {
+            x += h;
+            steps++;
+            snapshot.state.assign(1, x);
+        }, threaded);
+        // Nothing to read before the first step
+        physics.read([](auto&, auto&, num) { FAIL(); });
+
+        physics.advanceTo(1.0);
+        physics.advanceTo(1.2);
+        physics.wait();
+        REQUIRE(steps == 3);
+        // Rendered one step behind the target, between the last two snapshots
+        physics.read([&](const PhysicsThread::Snapshot& previous, const PhysicsThread::Snapshot& latest, num alpha) {
+            REQUIRE(previous.t == Approx(1.125));
+            REQUIRE(latest.t == Approx(1.1875));
+            REQUIRE(latest.state[0] == Approx(0.1875));
+            REQUIRE(previous.state[0] + alpha * (latest.state[0] - previous.state[0]) == Approx(0.1375));
+        });
+
+        // Edits are visible in the snapshots of later steps
+        {
+            auto lock = physics.lockWorld();
+            x = 10.0;
+        }
+        auto edits = physics.getEdits();
+        physics.advanceTo(1.25);
+        physics.wait();
+        physics.read([&](const PhysicsThread::Snapshot&, const PhysicsThread::Snapshot& latest, num) {
+            REQUIRE(latest.edits == edits);
+            REQUIRE(latest.state[0] == Approx(10.0625));
+        });
+
+        // A long stall drops simulation time instead of catching up
+        physics.advanceTo(100.0);
+        physics.wait();
+        REQUIRE(steps == 4 + static_cast<size_t>(PhysicsThread::maxLag / step));
+    }
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,84 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "math/Num.hpp"
+#include "math/Vec.hpp"
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tl/function_ref.hpp>
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+/// Runs a simulation with a fixed timestep on its own thread. The owner moves the target time forward every frame and the thread takes steps until it caught up.
+/// Every step publishes a snapshot of the state. Snapshots are triple buffered, so the renderer can interpolate between the last two while the next one is written
+class PhysicsThread {
+    public:
+    /// State after a step
+    struct Snapshot {
+        /// Simulation time
+        num t = 0;
+        /// Number of world edits made before the step
+        size_t edits = 0;
+        Vec state;
+    };
+    /// Advance the simulation by h and write the new state into the snapshot. Called on the physics thread with the world locked
+    using Step = std::function<void(num h, Snapshot& snapshot)>;
+    /// Called with the previous and the latest snapshot and the interpolation weight of the latest one
+    using Reader = tl::function_ref<void(const Snapshot& previous, const Snapshot& latest, num alpha)>;
+    /// Simulation time that is dropped instead of caught up with, so that a slow simulation does not fall further and further behind
+    static constexpr num maxLag = 0.25;
+
+    private:
+    num step;
+    Step stepFunction;
+    std::thread thread;
+    /// Guards the simulation against edits from other threads
+    std::mutex worldMutex;
+    size_t edits = 0;
+    /// Guards target, time and stopping
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable caughtUp;
+    num target = 0;
+    /// Time of the latest step, NaN before the first target
+    num time = NAN;
+    bool stopping = false;
+    /// Guards the snapshot indices
+    std::mutex snapshotMutex;
+    std::array<Snapshot, 3> snapshots;
+    unsigned previous = 0, latest = 1, back = 2;
+    /// Number of published snapshots, up to 2
+    unsigned published = 0;
+    /// Time the renderer shows, one step behind the target
+    num renderTime = 0;
+
+    void run();
+    /// Take steps until the target is reached
+    void advance();
+
+    public:
+    /// Steps of the given size, on a thread of its own if threaded is set and threads are available
+    PhysicsThread(num step, Step stepFunction, bool threaded = true);
+    ~PhysicsThread() noexcept;
+
+    PhysicsThread(const PhysicsThread&) = delete;
+    PhysicsThread& operator=(const PhysicsThread&) = delete;
+
+    bool isThreaded() const { return thread.joinable(); }
+    num getStep() const { return step; }
+    /// Lock the world for edits from another thread
+    std::unique_lock<std::mutex> lockWorld();
+    /// Number of lockWorld calls so far. A snapshot contains the edits made up to its edits count
+    size_t getEdits() const { return edits; }
+    /// Simulate up to time t. Returns immediately when threaded, otherwise takes the steps on the caller
+    void advanceTo(num t);
+    /// Block until the simulation caught up with the target time
+    void wait();
+    /// Read the two latest snapshots, interpolated one step behind the target time. Does nothing before the first step
+    void read(Reader reader);
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
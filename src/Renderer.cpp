@@ -0,0 +1,239 @@
+#include "Renderer.hpp"
+#include "math/Trace.hpp"
+#include <rlgl.h>
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+/// Flat colored spheres, the transform of each instance is a vertex attribute
+#if defined(PLATFORM_WEB)
+constexpr const char* instancedVertexShader = R"(#version 100
+attribute vec3 vertexPosition;
+attribute mat4 instanceTransform;
+uniform mat4 mvp;
+void main() {
+    gl_Position = mvp * instanceTransform * vec4(vertexPosition, 1.0);
+}
+)";
+constexpr const char* instancedFragmentShader = R"(#version 100
+precision mediump float;
+uniform vec4 colDiffuse;
+void main() {
+    gl_FragColor = colDiffuse;
+}
+)";
+#else
+constexpr const char* instancedVertexShader = R"(#version 330
+in vec3 vertexPosition;
+in mat4 instanceTransform;
+uniform mat4 mvp;
+void main() {
+    gl_Position = mvp * instanceTransform * vec4(vertexPosition, 1.0);
+}
+)";
+constexpr const char* instancedFragmentShader = R"(#version 330
+uniform vec4 colDiffuse;
+out vec4 finalColor;
+void main() {
+    finalColor = colDiffuse;
+}
+)";
+#endif
+//---------------------------------------------------------------------------
+bool operator==(const Color& a, const Color& b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+Frustum::Frustum(const Vec3& position, const Vec3& target, const Vec3& up, num fovy, num aspect, num near, num far)
+// The side planes pass through the camera position, near and far are perpendicular to the view direction
+{
+    auto forward = (target - position).normalized();
+    auto right = cross(forward, up).normalized();
+    auto trueUp = cross(right, forward);
+    auto tanY = tan(fovy * numbers::pi_v<num> / 360);
+    auto tanX = tanY * aspect;
+    auto side = [&](const Vec3& n) {
+        auto normal = n.normalized();
+        return Plane{normal, -(normal * position).sum()};
+    };
+    auto distance = (forward * position).sum();
+    planes = {
+        side(forward * tanX + right),
+        side(forward * tanX - right),
+        side(forward * tanY + trueUp),
+        side(forward * tanY - trueUp),
+        Plane{forward, -distance - near},
+        Plane{forward * -1, distance + far},
+    };
+}
+//---------------------------------------------------------------------------
+bool Frustum::intersectsSphere(const Vec3& center, num radius) const {
+    return ranges::all_of(planes, [&](const Plane& plane) { return (plane.n * center).sum() + plane.d >= -radius; });
+}
+//---------------------------------------------------------------------------
+Renderer::~Renderer() noexcept {
+    if (loaded) {
+        UnloadMesh(fine);
+        UnloadMesh(coarse);
+        UnloadMaterial(material);
+    }
+}
+//---------------------------------------------------------------------------
+void Renderer::load()
+// Unit spheres, scaled per instance. The fine mesh has the resolution of the former DrawSphereWires calls
+{
+    fine = GenMeshSphere(1, 16, 16);
+    coarse = GenMeshSphere(1, 6, 8);
+    material = LoadMaterialDefault();
+    material.shader = LoadShaderFromMemory(instancedVertexShader, instancedFragmentShader);
+    material.shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(material.shader, "instanceTransform");
+    loaded = true;
+}
+//---------------------------------------------------------------------------
+void Renderer::begin(const Camera& camera, num aspect)
+// Keeps the batches and their buffers, so that a steady scene does not allocate
+{
+    for (auto& batch : batches)
+        batch.transforms.clear();
+    wires.clear();
+    lines.clear();
+    stats = {};
+    cameraPosition = {camera.position.x, camera.position.y, camera.position.z};
+    Vec3 target{camera.target.x, camera.target.y, camera.target.z};
+    Vec3 up{camera.up.x, camera.up.y, camera.up.z};
+    frustum = Frustum(cameraPosition, target, up, camera.fovy, aspect, RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+}
+//---------------------------------------------------------------------------
+Renderer::Detail Renderer::getDetail(num radius, num distance) const
+// The ratio of radius and distance is about the size on screen
+{
+    if (!options.lod || radius >= options.wireSize * distance)
+        return Detail::Wired;
+    return radius >= options.coarseSize * distance ? Detail::Fine : Detail::Coarse;
+}
+//---------------------------------------------------------------------------
+void Renderer::addSphere(const Vec3& center, num radius, Color color) {
+    if (options.cull && !frustum.intersectsSphere(center, radius)) {
+        stats.culledSpheres++;
+        return;
+    }
+    stats.spheres++;
+    auto detail = getDetail(radius, (center - cameraPosition).len());
+    auto r = static_cast<float>(radius);
+    Vector3 x = center;
+    Matrix transform{r, 0, 0, x.x, 0, r, 0, x.y, 0, 0, r, x.z, 0, 0, 0, 1};
+    bool isCoarse = detail == Detail::Coarse;
+    auto batch = ranges::find_if(batches, [&](const Batch& b) { return b.coarse == isCoarse && b.color == color; });
+    if (batch == batches.end()) {
+        batches.push_back({color, isCoarse, {}});
+        batch = prev(batches.end());
+    }
+    batch->transforms.push_back(transform);
+    if (isCoarse)
+        stats.coarseSpheres++;
+    if (detail == Detail::Wired)
+        wires.push_back(transform);
+}
+//---------------------------------------------------------------------------
+void Renderer::addLine(const Vec3& a, const Vec3& b, Color color) {
+    if (options.cull && !frustum.intersectsSphere((a + b) * 0.5, (b - a).len() * 0.5)) {
+        stats.culledLines++;
+        return;
+    }
+    stats.lines++;
+    lines.push_back({a, b, color});
+}
+//---------------------------------------------------------------------------
+void Renderer::draw() {
+    math::TraceScope trace("render");
+    if (!loaded)
+        load();
+    for (auto& batch : batches) {
+        if (batch.transforms.empty())
+            continue;
+        material.maps[MATERIAL_MAP_DIFFUSE].color = batch.color;
+        DrawMeshInstanced(batch.coarse ? coarse : fine, material, batch.transforms.data(), static_cast<int>(batch.transforms.size()));
+        stats.drawCalls++;
+    }
+    if (!wires.empty()) {
+#if defined(PLATFORM_WEB)
+        // WebGL has no wireframe mode, only the spheres close to the camera get here
+        for (auto& t : wires)
+            DrawSphereWires({t.m12, t.m13, t.m14}, t.m0, 16, 16, BLACK);
+#else
+        material.maps[MATERIAL_MAP_DIFFUSE].color = BLACK;
+        rlEnableWireMode();
+        DrawMeshInstanced(fine, material, wires.data(), static_cast<int>(wires.size()));
+        rlDisableWireMode();
+        stats.drawCalls++;
+#endif
+    }
+    // All lines go into the render batch of raylib, which is drawn at the end of the 3D mode
+    if (!lines.empty()) {
+        rlBegin(RL_LINES);
+        for (auto& line : lines) {
+            rlColor4ub(line.color.r, line.color.g, line.color.b, line.color.a);
+            rlVertex3f(line.a.x, line.a.y, line.a.z);
+            rlVertex3f(line.b.x, line.b.y, line.b.z);
+        }
+        rlEnd();
+    }
+}
+//---------------------------------------------------------------------------
+TEST_CASE("Renderer") {
+    // Looking down -z with a 90 degree field of view, the view spans |x| <= -z
+    Frustum frustum({0, 0, 0}, {0, 0, -1}, {0, 1, 0}, 90, 1, 0.1, 100);
+    REQUIRE(frustum.intersectsSphere({0, 0, -10}, 1));
+    REQUIRE(frustum.intersectsSphere({10.5, 0, -10}, 1));
+    REQUIRE(!frustum.intersectsSphere({20, 0, -10}, 1));
+    REQUIRE(!frustum.intersectsSphere({0, -20, -10}, 1));
+    REQUIRE(!frustum.intersectsSphere({0, 0, 10}, 1));
+    REQUIRE(!frustum.intersectsSphere({0, 0, -200}, 1));
+    // A wider aspect only widens the view horizontally
+    Frustum wide({0, 0, 0}, {0, 0, -1}, {0, 1, 0}, 90, 2, 0.1, 100);
+    REQUIRE(wide.intersectsSphere({15, 0, -10}, 1));
+    REQUIRE(!wide.intersectsSphere({0, 15, -10}, 1));
+
+    // Nothing is loaded before the first draw, sorting into batches works without a window
+    Renderer renderer;
+    REQUIRE(renderer.getDetail(1, 5) == Renderer::Detail::Wired);
+    REQUIRE(renderer.getDetail(1, 40) == Renderer::Detail::Fine);
+    REQUIRE(renderer.getDetail(1, 100) == Renderer::Detail::Coarse);
+    Camera camera{};
+    camera.target = {0, 0, -1};
+    camera.up = {0, 1, 0};
+    camera.fovy = 90;
+    renderer.begin(camera, 1);
+    renderer.addSphere({0, 0, -5}, 1, RED);
+    renderer.addSphere({0, 0, -100}, 1, RED);
+    renderer.addSphere({0, 0, 5}, 1, RED);
+    renderer.addLine({0, 0, -5}, {0, 0, -100}, BLACK);
+    renderer.addLine({0, 0, 5}, {0, 0, 10}, BLACK);
+    auto& stats = renderer.getStats();
+    REQUIRE(stats.spheres == 2);
+    REQUIRE(stats.culledSpheres == 1);
+    REQUIRE(stats.coarseSpheres == 1);
+    REQUIRE(stats.lines == 1);
+    REQUIRE(stats.culledLines == 1);
+
+    // Without culling and level of detail every sphere is drawn in full
+    renderer.options.cull = false;
+    renderer.options.lod = false;
+    renderer.begin(camera, 1);
+    renderer.addSphere({0, 0, -100}, 1, RED);
+    renderer.addSphere({0, 0, 5}, 1, RED);
+    REQUIRE(renderer.getStats().spheres == 2);
+    REQUIRE(renderer.getStats().coarseSpheres == 0);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,102 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "Vec3.hpp"
+#include "math/Num.hpp"
+#include <raylib.h>
+#include <array>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+/// View volume of a perspective camera as six planes with inward normals
+struct Frustum {
+    struct Plane {
+        Vec3 n;
+        num d = 0;
+    };
+    std::array<Plane, 6> planes;
+
+    Frustum() = default;
+    /// Frustum of a camera at position looking at target, fovy is the vertical field of view in degrees
+    Frustum(const Vec3& position, const Vec3& target, const Vec3& up, num fovy, num aspect, num near, num far);
+    /// Whether a sphere is at least partly inside
+    bool intersectsSphere(const Vec3& center, num radius) const;
+};
+//---------------------------------------------------------------------------
+/// Draws spheres and lines in batches. Spheres of one color and detail level are drawn with one instanced draw call, all lines are one upload into the raylib render batch.
+/// The GPU resources are loaded with the first frame, so the renderer must be destroyed before the window is closed
+class Renderer {
+    public:
+    struct Options {
+        /// Skip spheres and lines outside the view
+        bool cull = true;
+        /// Use a coarse mesh and no wireframe for spheres that are small on screen
+        bool lod = true;
+        /// Spheres whose radius is below this fraction of their distance to the camera use the coarse mesh
+        num coarseSize = 0.02;
+        /// Spheres whose radius is below this fraction of their distance to the camera get no wireframe
+        num wireSize = 0.05;
+    };
+    /// Detail level of a sphere
+    enum class Detail {
+        Coarse,
+        Fine,
+        /// Fine with a wireframe on top
+        Wired
+    };
+    /// Work of the last frame
+    struct Stats {
+        size_t spheres = 0;
+        size_t culledSpheres = 0;
+        size_t coarseSpheres = 0;
+        size_t lines = 0;
+        size_t culledLines = 0;
+        /// Instanced draw calls of the spheres and wireframes
+        size_t drawCalls = 0;
+    };
+    Options options;
+
+    private:
+    /// Sphere transforms of one color and detail level, uploaded as one instance buffer
+    struct Batch {
+        Color color;
+        bool coarse = false;
+        std::vector<Matrix> transforms;
+    };
+    struct Line {
+        Vector3 a, b;
+        Color color;
+    };
+    std::vector<Batch> batches;
+    /// Transforms of the spheres with a wireframe
+    std::vector<Matrix> wires;
+    std::vector<Line> lines;
+    Vec3 cameraPosition;
+    Frustum frustum;
+    Stats stats;
+    bool loaded = false;
+    Mesh fine{}, coarse{};
+    Material material{};
+
+    void load();
+
+    public:
+    Renderer() = default;
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+    ~Renderer() noexcept;
+
+    /// Start a frame seen by camera, drops the spheres and lines of the last one
+    void begin(const Camera& camera, num aspect);
+    /// Detail level of a sphere at distance from the camera
+    Detail getDetail(num radius, num distance) const;
+    void addSphere(const Vec3& center, num radius, Color color);
+    void addLine(const Vec3& a, const Vec3& b, Color color);
+    /// Draw everything added since begin, between BeginMode3D and EndMode3D
+    void draw();
+
+    const Stats& getStats() const { return stats; }
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,320 @@
+#include "Scene.hpp"
+#include "math/Trace.hpp"
+#include <algorithm>
+#include <cassert>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+template <typename T>
+void Scene::watch() {
+    registry.on_construct<T>().template connect<&Scene::markDirty>(*this);
+    registry.on_update<T>().template connect<&Scene::markDirty>(*this);
+    registry.on_destroy<T>().template connect<&Scene::markDirty>(*this);
+}
+//---------------------------------------------------------------------------
+Scene::Scene() {
+    watch<Position>();
+    watch<Particle>();
+    watch<Gravity>();
+    watch<Force>();
+    watch<FixConstraint>();
+    watch<DistanceConstraint>();
+    registry.on_construct<Position>().connect<&Scene::markMoved>(*this);
+    registry.on_update<Position>().connect<&Scene::markMoved>(*this);
+    registry.on_construct<Particle>().connect<&Scene::markMoved>(*this);
+    registry.on_update<Particle>().connect<&Scene::markMoved>(*this);
+    registry.on_destroy<PhysicsBody>().connect<&Scene::releaseBody>(*this);
+    // Use all hardware threads for constraints and forces
+    world.setThreadCount(0);
+    // One RK4 step per frame. A calm frame is a single step with Integrator::DormandPrince as well, but one that costs six evaluations instead of four
+}
+//---------------------------------------------------------------------------
+void Scene::markDirty(entt::registry&, entt::entity e) {
+    dirty.push_back(e);
+}
+//---------------------------------------------------------------------------
+void Scene::markMoved(entt::registry&, entt::entity e) {
+    moved.push_back(e);
+}
+//---------------------------------------------------------------------------
+void Scene::releaseBody(entt::registry&, entt::entity e) {
+    released.push_back(move(registry.get<PhysicsBody>(e)));
+}
+//---------------------------------------------------------------------------
+void Scene::syncBody(entt::entity e) {
+    if (!registry.valid(e))
+        return;
+    auto* part = registry.try_get<Particle>(e);
+    auto* pos = registry.try_get<Position>(e);
+    if (!part || !pos) {
+        registry.remove<PhysicsBody>(e);
+        registry.remove<RenderPosition>(e);
+        return;
+    }
+    num xs[] = {pos->x.x, pos->x.y, pos->x.z};
+    num vs[] = {part->v.x, part->v.y, part->v.z};
+    num ms[] = {part->m, part->m, part->m};
+    if (auto* body = registry.try_get<PhysicsBody>(e)) {
+        // Position and velocity in the registry are those of the last snapshot, the world may be further. Only explicit edits replace its state
+        if (!ranges::binary_search(moved, e))
+            return;
+        auto cap = world.capacity();
+        for (unsigned i = 0; i < 3; i++) {
+            world.state[body->offset + i] = xs[i];
+            world.state[cap + body->offset + i] = vs[i];
+            world.ms[body->offset + i] = ms[i];
+        }
+        world.wake(body->offset, 3);
+        registry.get<RenderPosition>(e).x = pos->x;
+    } else {
+        registry.emplace<PhysicsBody>(e, PhysicsBody{world.addComponents(xs, vs, ms), physics.getEdits(), {}, {}});
+        registry.emplace<RenderPosition>(e, RenderPosition{pos->x});
+    }
+    part->offset = registry.get<PhysicsBody>(e).offset;
+}
+//---------------------------------------------------------------------------
+void Scene::syncLinks(entt::entity e) {
+    auto* body = registry.valid(e) ? registry.try_get<PhysicsBody>(e) : nullptr;
+    if (!body)
+        return;
+    for (auto id : body->forces)
+        world.removeForce(id);
+    for (auto id : body->constraints)
+        world.removeConstraint(id);
+    body->forces.clear();
+    body->constraints.clear();
+
+    auto& part = registry.get<const Particle>(e);
+    auto* constantForce = math::Force::getConstant();
+    num gravitationalConstant = 9.81;
+    if (registry.all_of<Gravity>(e))
+        body->forces.push_back(world.addForce(constantForce, {part.offset, part.offset + 1, part.offset + 2}, {0.0, -gravitationalConstant * part.m, 0.0}));
+    if (auto* forceComponent = registry.try_get<const Force>(e))
+        body->forces.push_back(world.addForce(constantForce, {part.offset, part.offset + 1, part.offset + 2}, {forceComponent->f.x, forceComponent->f.y, forceComponent->f.z}));
+    if (auto* fix = registry.try_get<const FixConstraint>(e))
+        body->constraints.push_back(world.addConstraint(math::Constraint::getFixed(), {part.offset, part.offset + 1, part.offset + 2}, {fix->pos.x, fix->pos.y, fix->pos.z}));
+    // The other entity may be gone, then the link is dropped
+    auto* dist = registry.try_get<const DistanceConstraint>(e);
+    auto* pos2 = dist && registry.valid(dist->otherEntity) ? registry.try_get<const Position>(dist->otherEntity) : nullptr;
+    if (pos2) {
+        auto* part2 = registry.try_get<const Particle>(dist->otherEntity);
+        if (part2) {
+            body->constraints.push_back(world.addConstraint(math::Constraint::getDistance2(), {part.offset, part.offset + 1, part.offset + 2, part2->offset, part2->offset + 1, part2->offset + 2}, {dist->distance}));
+        } else {
+            body->constraints.push_back(world.addConstraint(math::Constraint::getDistance1(), {part.offset, part.offset + 1, part.offset + 2}, {pos2->x.x, pos2->x.y, pos2->x.z, dist->distance}));
+        }
+    }
+}
+//---------------------------------------------------------------------------
+void Scene::syncWorld() {
+    if (dirty.empty() && released.empty())
+        return;
+    ranges::sort(dirty);
+    dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+    ranges::sort(moved);
+    // Bodies first, links may refer to other dirty bodies
+    for (auto e : dirty)
+        syncBody(e);
+    // A link to a dirty entity may point to a moved anchor, a new particle or a released one
+    auto count = dirty.size();
+    registry.view<const DistanceConstraint>().each([&](entt::entity e, const DistanceConstraint& dc) {
+        if (binary_search(dirty.begin(), dirty.begin() + count, dc.otherEntity))
+            dirty.push_back(e);
+    });
+    ranges::sort(dirty);
+    dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+    for (auto e : dirty)
+        syncLinks(e);
+    // No constraint refers to the released bodies anymore
+    for (auto& body : released) {
+        for (auto id : body.forces)
+            world.removeForce(id);
+        for (auto id : body.constraints)
+            world.removeConstraint(id);
+        world.removeComponents(body.offset, 3);
+    }
+    dirty.clear();
+    moved.clear();
+    released.clear();
+}
+//---------------------------------------------------------------------------
+void Scene::gatherColliders() {
+    collisions.clear();
+    registry.view<const Position, const Collider>().each([&](entt::entity e, const Position& p, const Collider& c) {
+        auto* part = registry.try_get<const Particle>(e);
+        if (c.type == ColliderType::Ground) {
+            // Axis collider cannot have physics
+            assert(!part);
+            collisions.addPlane(p.x, c.up);
+        } else if (part) {
+            collisions.addParticle(part->offset, c.radius);
+        } else {
+            collisions.addSphere(p.x, c.radius);
+        }
+    });
+}
+//---------------------------------------------------------------------------
+void Scene::stepPhysics(num h, PhysicsThread::Snapshot& snapshot) {
+    math::TraceScope trace("stepPhysics");
+    collisions.addContacts(world);
+    auto substeps = world.step(h).steps;
+    snapshot.state = world.state;
+    lock_guard lock(statsMutex);
+    physicsStats = world.getStats();
+    physicsSubsteps = substeps;
+}
+//---------------------------------------------------------------------------
+void Scene::updatePhysics(num totalTime) {
+    math::TraceScope trace("updatePhysics");
+    {
+        auto lock = physics.lockWorld();
+        syncWorld();
+        gatherColliders();
+    }
+    physics.advanceTo(totalTime);
+}
+//---------------------------------------------------------------------------
+void Scene::interpolatePhysics()
+// The particles are shown between the last two steps
+{
+    physics.read([&](const PhysicsThread::Snapshot& previous, const PhysicsThread::Snapshot& latest, num alpha) {
+        auto previousCap = previous.state.size() / 2;
+        auto latestCap = latest.state.size() / 2;
+        registry.view<Position, Particle, RenderPosition, const PhysicsBody>().each([&](Position& pos, Particle& part, RenderPosition& shown, const PhysicsBody& body) {
+            if (latest.edits < body.since || body.offset + 3 > latestCap)
+                return;
+            auto& from = previous.edits < body.since || body.offset + 3 > previousCap ? latest : previous;
+            auto* x0 = &from.state[body.offset];
+            auto* x1 = &latest.state[body.offset];
+            auto* v1 = &latest.state[latestCap + body.offset];
+            pos.x = {x1[0], x1[1], x1[2]};
+            part.v = {v1[0], v1[1], v1[2]};
+            shown.x = {x0[0] + alpha * (x1[0] - x0[0]), x0[1] + alpha * (x1[1] - x0[1]), x0[2] + alpha * (x1[2] - x0[2])};
+        });
+    });
+}
+//---------------------------------------------------------------------------
+static vector<entt::entity> addPendulum(entt::registry& registry, unsigned balls)
+// Balls with gravity in a row, one apart and linked to the previous one, the first one fixed
+{
+    vector<entt::entity> pendulum;
+    for (unsigned i = 0; i < balls; i++) {
+        auto ball = registry.create();
+        registry.emplace<Position>(ball, Position{{static_cast<num>(i), 2.0, 0.0}});
+        registry.emplace<Particle>(ball, Particle{10.0, {}});
+        registry.emplace<Gravity>(ball);
+        if (i)
+            registry.emplace<DistanceConstraint>(ball, DistanceConstraint{pendulum.back(), 1.0});
+        else
+            registry.emplace<FixConstraint>(ball, FixConstraint{registry.get<Position>(ball).x});
+        pendulum.push_back(ball);
+    }
+    return pendulum;
+}
+//---------------------------------------------------------------------------
+TEST_CASE("Scene edits of moving bodies") {
+    // The end of a pendulum swings down. Adding a force to it must not reset it to the position it had in the registry
+    Scene scene;
+    auto& registry = scene.registry;
+    auto end = addPendulum(registry, 3).back();
+    num time = 1;
+    auto frame = [&] {
+        time += scene.physicsStep;
+        scene.updatePhysics(time);
+        scene.physics.wait();
+        scene.interpolatePhysics();
+    };
+    auto simulated = [&] {
+        auto lock = scene.physics.lockWorld();
+        auto offset = registry.get<const PhysicsBody>(end).offset;
+        return Vec3{scene.world.xs()[offset], scene.world.xs()[offset + 1], scene.world.xs()[offset + 2]};
+    };
+    for (unsigned i = 0; i < 20; i++)
+        frame();
+    // The interpolated position lags behind, the registry has the latest state
+    auto before = simulated();
+    REQUIRE((registry.get<const Position>(end).x - before).len() < epsilon);
+    REQUIRE((registry.get<const RenderPosition>(end).x - before).len() > epsilon);
+
+    registry.emplace<Force>(end, Force{{1.0, 0.0, 0.0}});
+    {
+        auto lock = scene.physics.lockWorld();
+        scene.syncWorld();
+    }
+    REQUIRE((simulated() - before).len() < epsilon);
+    // It keeps falling from there
+    frame();
+    REQUIRE(simulated().y < before.y);
+
+    // Editing the position itself moves the body
+    registry.patch<Position>(end, [](Position& pos) { pos.x.y = 5; });
+    {
+        auto lock = scene.physics.lockWorld();
+        scene.syncWorld();
+    }
+    REQUIRE(simulated().y == 5);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("Scene links to changed entities") {
+    using Catch::Approx;
+    Scene scene;
+    auto& registry = scene.registry;
+    auto pendulum = addPendulum(registry, 3);
+    num time = 1;
+    auto frame = [&] {
+        time += scene.physicsStep;
+        scene.updatePhysics(time);
+        scene.physics.wait();
+        scene.interpolatePhysics();
+    };
+    auto sync = [&] {
+        auto lock = scene.physics.lockWorld();
+        scene.syncWorld();
+    };
+    auto persistentConstraints = [&] {
+        auto lock = scene.physics.lockWorld();
+        return scene.world.numConstraints() - scene.world.numContacts();
+    };
+    auto simulated = [&](entt::entity e) {
+        auto lock = scene.physics.lockWorld();
+        auto offset = registry.get<const PhysicsBody>(e).offset;
+        return Vec3{scene.world.xs()[offset], scene.world.xs()[offset + 1], scene.world.xs()[offset + 2]};
+    };
+
+    // A weightless particle hanging from an anchor follows the anchor when both are moved
+    auto anchor = registry.create();
+    registry.emplace<Position>(anchor, Position{{0.0, 10.0, 0.0}});
+    auto ball = registry.create();
+    registry.emplace<Position>(ball, Position{{1.0, 10.0, 0.0}});
+    registry.emplace<Particle>(ball, Particle{1.0, {}});
+    registry.emplace<DistanceConstraint>(ball, DistanceConstraint{anchor, 1.0});
+    frame();
+    registry.patch<Position>(anchor, [](Position& pos) { pos.x.x = 5; });
+    registry.patch<Position>(ball, [](Position& pos) { pos.x = {6.0, 10.0, 0.0}; });
+    for (unsigned i = 0; i < 10; i++)
+        frame();
+    REQUIRE((simulated(ball) - Vec3{6.0, 10.0, 0.0}).len() < 0.01);
+
+    // The middle ball of the pendulum stops being a particle, the end ball now hangs from its position
+    auto middle = pendulum[1], end = pendulum[2];
+    auto before = persistentConstraints();
+    registry.remove<Particle>(middle);
+    sync();
+    REQUIRE(persistentConstraints() == before - 1);
+    for (unsigned i = 0; i < 10; i++)
+        frame();
+    REQUIRE((simulated(end) - registry.get<const Position>(middle).x).len() == Approx(1.0).margin(0.05));
+
+    // Destroying it drops the link
+    registry.destroy(middle);
+    sync();
+    REQUIRE(persistentConstraints() == before - 2);
+    frame();
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
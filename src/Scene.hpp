@@ -0,0 +1,102 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "Collisions.hpp"
+#include "PhysicsThread.hpp"
+#include "Vec3.hpp"
+#include "math/Num.hpp"
+#include "math/Physics.hpp"
+#include <mutex>
+#include <vector>
+#include <entt/entity/registry.hpp>
+//---------------------------------------------------------------------------
+namespace physman {
+//---------------------------------------------------------------------------
+struct Position {
+    Vec3 x;
+};
+struct Particle {
+    num m;
+    Vec3 v;
+    unsigned offset = 0;
+};
+struct Gravity {};
+struct Force {
+    Vec3 f;
+};
+enum class ColliderType {
+    Sphere, Ground
+};
+struct Collider {
+    ColliderType type = ColliderType::Sphere;
+    num radius = 0.0;
+    Vec3 up = {0.0, 1.0, 0.0};
+};
+/// Position drawn for a simulated particle, between its last two physics steps. Lags Position by up to a step and is never read back into the simulation
+struct RenderPosition {
+    Vec3 x;
+};
+struct FixConstraint {
+    Vec3 pos;
+};
+struct DistanceConstraint {
+    entt::entity otherEntity{};
+    num distance = 0.0;
+};
+/// Physics world objects owned by a particle
+struct PhysicsBody {
+    unsigned offset = 0;
+    /// World edit that added the particle, older snapshots do not contain it
+    size_t since = 0;
+    std::vector<math::ForceId> forces;
+    std::vector<math::ConstraintId> constraints;
+};
+//---------------------------------------------------------------------------
+/// The entities and the physics world kept in sync with them. The world steps on the physics thread, the registry is only touched by the owner
+struct Scene {
+    /// The physics world, kept in sync with the registry. Only touched with the world locked
+    math::Physics world;
+    /// Entities whose physics objects have to be rebuilt
+    std::vector<entt::entity> dirty;
+    /// Dirty entities whose Position or Particle was edited, their simulated state is replaced with the edited one
+    std::vector<entt::entity> moved;
+    /// Bodies of entities that lost their particle, removed from the world with the next syncWorld once no link refers to them
+    std::vector<PhysicsBody> released;
+    /// Copies of the colliders, so that the physics thread does not read the registry
+    Collisions collisions;
+    entt::registry registry;
+    num physicsStep = 1.0 / 64;
+    /// Copied from the physics thread after every step
+    std::mutex statsMutex;
+    math::PhysicsStats physicsStats;
+    /// Substeps taken by the last physics step
+    size_t physicsSubsteps = 0;
+    /// Steps the world at a fixed rate and publishes its state for drawing
+    PhysicsThread physics{physicsStep, [this](num h, PhysicsThread::Snapshot& snapshot) { stepPhysics(h, snapshot); }};
+
+    Scene();
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+
+    /// Apply the edits of the registry to the world. Requires the world lock
+    void syncWorld();
+    /// Copy the colliders for the physics thread. Requires the world lock
+    void gatherColliders();
+    /// Sync the world and let the physics thread catch up with totalTime
+    void updatePhysics(num totalTime);
+    /// Position and velocity become the latest simulated ones, RenderPosition lies between the last two steps
+    void interpolatePhysics();
+
+    private:
+    template <typename T>
+    void watch();
+    void markDirty(entt::registry&, entt::entity e);
+    void markMoved(entt::registry&, entt::entity e);
+    void releaseBody(entt::registry&, entt::entity e);
+    void syncBody(entt::entity e);
+    void syncLinks(entt::entity e);
+    /// Find contacts at the current state and take a step. Runs on the physics thread
+    void stepPhysics(num h, PhysicsThread::Snapshot& snapshot);
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,282 @@
+#include "math/Algorithm.hpp"
+#include "math/Constraint.hpp"
+#include "math/Preconditioner.hpp"
+#include "math/SparseMatrix.hpp"
+#include <cmath>
+#include <vector>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_session.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+//---------------------------------------------------------------------------
+using namespace std;
+using namespace physman;
+using namespace physman::math;
+//---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+/// Instances per batch, about the contacts of a ball pit
+constexpr size_t batchCount = 1024;
+//---------------------------------------------------------------------------
+struct ConstraintCase {
+    const char* name;
+    const Constraint* constraint;
+    /// Parameters of one instance
+    Vec params;
+};
+//---------------------------------------------------------------------------
+vector<ConstraintCase> getConstraintCases()
+// Every constraint, with parameters that keep the collisions active at the positions of makeScope
+{
+    return {
+        {"distance1", Constraint::getDistance1(), {0.1, 0.2, 0.0, 0.25}},
+        {"distance2", Constraint::getDistance2(), {0.25}},
+        {"fixed", Constraint::getFixed(), {0.0, 0.0, 0.0}},
+        {"sphereCollision1", Constraint::getSphereCollision1(), {0.1, 0.2, 0.0, 0.5}},
+        {"sphereCollision2", Constraint::getSphereCollision2(), {1.5}},
+        {"planeCollision1", Constraint::getPlaneCollision1(), {0.0, 1.0, 0.0, 0.5}},
+    };
+}
+//---------------------------------------------------------------------------
+ValScope makeScope(unsigned components)
+// Positions and velocities that are not zero in any component, the second particle is about 1 away from the first
+{
+    ValScope scope;
+    for (unsigned i = 0; i < components; i++) {
+        scope.xs.push_back(0.1 * i + (i >= 3 ? 0.3 : 0.0));
+        scope.vs.push_back(0.05 * (i + 1));
+    }
+    scope.t = 0;
+    return scope;
+}
+//---------------------------------------------------------------------------
+/// Jacobian of distance constraints between neighbors of a chain or a grid of particles, as assembled by Physics
+struct LinkSystem {
+    SparseMatrix J;
+    Vec W;
+    Vec b;
+};
+//---------------------------------------------------------------------------
+LinkSystem makeLinkSystem(unsigned width, unsigned height)
+// Particles on a slightly distorted grid, the first one is fixed so that the system is definite
+{
+    auto particles = width * height;
+    vector<num> xs(particles * 3);
+    for (unsigned i = 0; i < particles; i++) {
+        xs[i * 3] = i % width + 0.1 * sin(i);
+        xs[i * 3 + 1] = 0.1 * cos(i);
+        xs[i * 3 + 2] = i / width + 0.1 * sin(2.0 * i);
+    }
+    vector<pair<unsigned, unsigned>> links;
+    for (unsigned i = 0; i < particles; i++) {
+        if (i % width + 1 < width)
+            links.emplace_back(i, i + 1);
+        if (i + width < particles)
+            links.emplace_back(i, i + width);
+    }
+
+    LinkSystem system;
+    auto& J = system.J;
+    J.resetPattern(particles * 3);
+    for (unsigned k = 0; k < 3; k++) {
+        unsigned col = k;
+        J.addRow({&col, 1});
+    }
+    for (auto [a, b] : links) {
+        unsigned cols[] = {a * 3, a * 3 + 1, a * 3 + 2, b * 3, b * 3 + 1, b * 3 + 2};
+        J.addRow(cols);
+    }
+    J.finishPattern();
+    for (unsigned k = 0; k < 3; k++)
+        J.getRowValues(k)[0] = 1;
+    for (size_t row = 0; row < links.size(); row++) {
+        auto [a, b] = links[row];
+        auto values = J.getRowValues(row + 3);
+        for (unsigned k = 0; k < 3; k++) {
+            values[k] = 2 * (xs[a * 3 + k] - xs[b * 3 + k]);
+            values[k + 3] = -values[k];
+        }
+    }
+    system.W.assign(particles * 3, 1.0);
+    system.b.resize(J.rows());
+    for (size_t i = 0; i < system.b.size(); i++)
+        system.b[i] = sin(0.37 * i);
+    return system;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+TEST_CASE("bench/Constraint", "[.][benchmark][micro]") {
+    for (auto& c : getConstraintCases()) {
+        auto components = c.constraint->numComponents();
+        auto scope = makeScope(components);
+        scope.ps = c.params;
+        REQUIRE(c.constraint->numParameters() == c.params.size());
+
+        BENCHMARK(fmt::format("{} C", c.name)) { return c.constraint->computeC(scope); };
+        BENCHMARK(fmt::format("{} C_dt", c.name)) { return c.constraint->computeC_dt(scope); };
+        BENCHMARK(fmt::format("{} J", c.name)) { return c.constraint->computeJacobian(scope); };
+        BENCHMARK(fmt::format("{} J_dt", c.name)) { return c.constraint->computeJacobian_dt(scope); };
+
+        // The path taken by Physics, all values of a group at once
+        vector<unsigned> indices(batchCount * components);
+        vector<num> params;
+        for (size_t i = 0; i < batchCount; i++) {
+            for (unsigned k = 0; k < components; k++)
+                indices[i * components + k] = k;
+            params.insert(params.end(), c.params.begin(), c.params.end());
+        }
+        Vec xs, vs, ps;
+        Constraint::gather(scope.xs, scope.vs, indices, components, params, c.constraint->numParameters(), xs, vs, ps);
+        BatchScope batch{xs.data(), vs.data(), ps.data(), 0.0, batchCount};
+        Vec C(batchCount), C_dt(batchCount), J(batchCount * components);
+        BENCHMARK(fmt::format("{} batch of {}", c.name, batchCount)) {
+            c.constraint->computeBatch(batch, C, C_dt, J);
+            return C[0];
+        };
+    }
+}
+//---------------------------------------------------------------------------
+TEST_CASE("bench/Constraint map", "[.][benchmark][micro]") {
+    // Six components of a world with a thousand particles
+    ValScope world;
+    world.xs.resize(3000);
+    world.vs.resize(3000);
+    for (size_t i = 0; i < world.xs.size(); i++) {
+        world.xs[i] = 0.001 * i;
+        world.vs[i] = -0.001 * i;
+    }
+    world.t = 0;
+    unsigned components[] = {300, 301, 302, 2100, 2101, 2102};
+    num params[] = {0.5};
+    BENCHMARK("map") { return Constraint::map(world, components, params); };
+
+    vector<unsigned> indices(batchCount * 6);
+    for (size_t i = 0; i < indices.size(); i++)
+        indices[i] = static_cast<unsigned>((i * 7919) % world.xs.size());
+    vector<num> batchParams(batchCount, 0.5);
+    Vec xs, vs, ps;
+    BENCHMARK(fmt::format("gather {}", batchCount)) {
+        Constraint::gather(world.xs, world.vs, indices, 6, batchParams, 1, xs, vs, ps);
+        return xs[0];
+    };
+}
+//---------------------------------------------------------------------------
+TEST_CASE("bench/SparseMatrix", "[.][benchmark][micro]") {
+    for (unsigned side : {10u, 30u, 100u}) {
+        auto system = makeLinkSystem(side, side);
+        auto& J = system.J;
+        auto name = fmt::format("{}x{} grid", side, side);
+
+        BENCHMARK(fmt::format("assemble {}", name)) {
+            SparseMatrix A;
+            A.resetPattern(J.cols());
+            for (size_t row = 0; row < J.rows(); row++)
+                A.addRow(J.getRowCols(row));
+            A.finishPattern();
+            for (size_t row = 0; row < J.rows(); row++) {
+                auto values = J.getRowValues(row);
+                copy(values.begin(), values.end(), A.getRowValues(row).begin());
+            }
+            return A.nonZeros();
+        };
+
+        Vec cols(J.cols(), 1.0), rows(J.rows(), 1.0), out;
+        BENCHMARK(fmt::format("dot {}", name)) {
+            J.dot(cols, out);
+            return out[0];
+        };
+        BENCHMARK(fmt::format("dotT {}", name)) {
+            J.dotT(rows, out);
+            return out[0];
+        };
+        J.updateLowValues();
+        BENCHMARK(fmt::format("dotLow {}", name)) {
+            J.dotLow(cols, out);
+            return out[0];
+        };
+        BENCHMARK(fmt::format("dotTLow {}", name)) {
+            J.dotTLow(rows, out);
+            return out[0];
+        };
+    }
+}
+//---------------------------------------------------------------------------
+TEST_CASE("bench/Algorithm solve", "[.][benchmark][micro]") {
+    // The systems J W J^T x = b of Physics with a Jacobi preconditioner
+    struct Shape {
+        unsigned width, height;
+    };
+    for (auto [width, height] : {Shape{100, 1}, Shape{1000, 1}, Shape{10, 10}, Shape{30, 30}}) {
+        auto system = makeLinkSystem(width, height);
+        auto& J = system.J;
+        Preconditioner preconditioner;
+        preconditioner.build(Preconditioner::Type::Jacobi, J, system.W);
+        Vec tmpCols, tmpRows;
+        auto A = [&](const Vec& x, Vec& out) {
+            J.dotT(x, tmpCols);
+            for (size_t i = 0; i < tmpCols.size(); i++)
+                tmpCols[i] *= system.W[i];
+            J.dot(tmpCols, out);
+        };
+        auto M = [&](const Vec& r, Vec& out) { preconditioner.apply(r, out); };
+        SolveOptions options;
+        options.maxIterations = 1000;
+        SolveWorkspace ws;
+        Vec x;
+        auto stats = Algorithm::solve(system.b, x, A, M, options, ws);
+        REQUIRE(stats.converged);
+
+        auto name = height == 1 ? fmt::format("cg chain of {}", width) : fmt::format("cg {}x{} grid", width, height);
+        BENCHMARK(fmt::format("{}, {} iterations", name, stats.iterations)) {
+            return Algorithm::solve(system.b, x, A, M, options, ws).iterations;
+        };
+
+        // Conjugate gradients on float values, refined with the full product
+        J.updateLowValues();
+        auto lowA = [&](const Vec& x, Vec& out) {
+            J.dotTLow(x, tmpCols);
+            for (size_t i = 0; i < tmpCols.size(); i++)
+                tmpCols[i] *= system.W[i];
+            J.dotLow(tmpCols, out);
+        };
+        stats = Algorithm::solveRefined(system.b, x, A, lowA, M, options, ws);
+        REQUIRE(stats.converged);
+        BENCHMARK(fmt::format("mixed {}, {} iterations", name, stats.iterations)) {
+            return Algorithm::solveRefined(system.b, x, A, lowA, M, options, ws).iterations;
+        };
+    }
+}
+//---------------------------------------------------------------------------
+TEST_CASE("bench/Algorithm ode", "[.][benchmark][micro]") {
+    // Undamped oscillators, x = [positions, velocities]
+    for (size_t size : {100u, 1000u, 10000u, 100000u}) {
+        Vec x(2 * size);
+        for (size_t i = 0; i < size; i++)
+            x[i] = sin(0.1 * i);
+        auto f = [&](const Vec& state, num, Vec& dx) {
+            dx.resize(state.size());
+            for (size_t i = 0; i < size; i++) {
+                dx[i] = state[size + i];
+                dx[size + i] = -state[i];
+            }
+        };
+        OdeWorkspace ws;
+        BENCHMARK(fmt::format("rk4 {}", size)) {
+            Algorithm::ode(x, 0.0, 1.0 / 64, f, ws, Integrator::RK4);
+            return x[0];
+        };
+    }
+}
+//---------------------------------------------------------------------------
+int main(int argc, const char* argv[])
+// Runs the micro benchmarks unless other tests are selected
+{
+    Catch::Session session;
+    if (auto result = session.applyCommandLine(argc, argv))
+        return result;
+    if (session.configData().testsOrTags.empty())
+        session.configData().testsOrTags.push_back("[micro]");
+    return session.run();
+}
+//---------------------------------------------------------------------------
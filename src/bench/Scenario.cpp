@@ -0,0 +1,99 @@
+#include "bench/Scenario.hpp"
+#include <cmath>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman::bench {
+//---------------------------------------------------------------------------
+unsigned Scenario::addParticle(const Vec3& x, num m) {
+    num xs[] = {x.x, x.y, x.z}, vs[] = {0, 0, 0}, ms[] = {m, m, m};
+    auto offset = world.addComponents(xs, vs, ms);
+    world.addForce(math::Force::getConstant(), {offset, offset + 1, offset + 2}, {0.0, num(-9.81) * m, 0.0});
+    return offset;
+}
+//---------------------------------------------------------------------------
+void Scenario::addChain(unsigned n, const Vec3& origin) {
+    num linkLength = 0.1;
+    unsigned prev = 0;
+    for (unsigned i = 0; i < n; i++) {
+        auto offset = addParticle(origin + Vec3{i * linkLength, 0.0, 0.0}, 1.0);
+        if (i == 0)
+            world.addConstraint(math::Constraint::getFixed(), {offset, offset + 1, offset + 2}, {origin.x, origin.y, origin.z});
+        else
+            world.addConstraint(math::Constraint::getDistance2(), {prev, prev + 1, prev + 2, offset, offset + 1, offset + 2}, {linkLength});
+        prev = offset;
+    }
+}
+//---------------------------------------------------------------------------
+void Scenario::addBallPit(unsigned n)
+// Same box as GameImpl::init, the balls start on a jittered grid in layers above the ground
+{
+    num boxWidth = 3.0;
+    collisions.addPlane({}, {0.0, 1.0, 0.0});
+    collisions.addPlane({-boxWidth, 0.0, 0.0}, {1.0, 0.0, 0.0});
+    collisions.addPlane({+boxWidth, 0.0, 0.0}, {-1.0, 0.0, 0.0});
+    collisions.addPlane({0.0, 0.0, -boxWidth}, {0.0, 0.0, 1.0});
+    collisions.addPlane({0.0, 0.0, +boxWidth}, {0.0, 0.0, -1.0});
+
+    num radius = 0.2;
+    num spacing = 2.5 * radius;
+    auto perRow = static_cast<unsigned>(2 * (boxWidth - radius) / spacing);
+    for (unsigned i = 0; i < n; i++) {
+        auto column = i % perRow;
+        auto row = (i / perRow) % perRow;
+        auto layer = i / (perRow * perRow);
+        auto jitter = num(0.1 * radius * (fmod(i * 0.618034, 1.0) - 0.5));
+        Vec3 x{-boxWidth + radius + spacing * (column + num(0.5)) + jitter, 1 + spacing * layer, -boxWidth + radius + spacing * (row + num(0.5)) - jitter};
+        collisions.addParticle(addParticle(x, 10.0), radius);
+    }
+}
+//---------------------------------------------------------------------------
+void Scenario::addSpringMesh(unsigned n, const Vec3& origin)
+// Structural springs between grid neighbors and shear springs along the diagonals
+{
+    auto side = max(2u, static_cast<unsigned>(lround(std::sqrt(static_cast<num>(n)))));
+    num spacing = 0.1;
+    num ks = 100.0, kd = 0.5;
+    num diagonal = spacing * std::sqrt(2.0);
+    vector<unsigned> offsets(side * side);
+    for (unsigned i = 0; i < side; i++)
+        for (unsigned k = 0; k < side; k++)
+            offsets[i * side + k] = addParticle(origin + Vec3{i * spacing, 0.0, k * spacing}, 0.1);
+    auto connect = [&](unsigned a, unsigned b, num length) {
+        world.addForce(math::Force::getSpring3(), {a, a + 1, a + 2, b, b + 1, b + 2}, {ks, kd, length});
+    };
+    for (unsigned i = 0; i < side; i++) {
+        for (unsigned k = 0; k < side; k++) {
+            auto a = offsets[i * side + k];
+            if (i + 1 < side)
+                connect(a, offsets[(i + 1) * side + k], spacing);
+            if (k + 1 < side)
+                connect(a, offsets[i * side + k + 1], spacing);
+            if (i + 1 < side && k + 1 < side) {
+                connect(a, offsets[(i + 1) * side + k + 1], diagonal);
+                connect(offsets[(i + 1) * side + k], offsets[i * side + k + 1], diagonal);
+            }
+        }
+    }
+    auto xs = world.xs();
+    for (unsigned corner : {offsets[0], offsets[side - 1]})
+        world.addConstraint(math::Constraint::getFixed(), {corner, corner + 1, corner + 2}, {xs[corner], xs[corner + 1], xs[corner + 2]});
+}
+//---------------------------------------------------------------------------
+span<const ScenarioType> getScenarioTypes() {
+    static const ScenarioType types[] = {
+        {"chain", [](Scenario& s, unsigned size) { s.addChain(size, {0.0, 4.0, 0.0}); }},
+        {"ballpit", [](Scenario& s, unsigned size) { s.addBallPit(size); }},
+        {"springmesh", [](Scenario& s, unsigned size) { s.addSpringMesh(size, {-1.0, 3.0, -1.0}); }},
+        // The chain and the mesh hang outside of the box
+        {"mixed", [](Scenario& s, unsigned size) {
+             s.addChain(size / 3, {5.0, 4.0, 0.0});
+             s.addBallPit(size / 3);
+             s.addSpringMesh(size - 2 * (size / 3), {-6.0, 3.0, -1.0});
+         }},
+    };
+    return types;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
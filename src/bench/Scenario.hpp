@@ -0,0 +1,35 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "Collisions.hpp"
+#include "Vec3.hpp"
+#include "math/Physics.hpp"
+#include <span>
+#include <string_view>
+//---------------------------------------------------------------------------
+namespace physman::bench {
+//---------------------------------------------------------------------------
+/// A physics world to benchmark, with the colliders its contacts are found from
+struct Scenario {
+    math::Physics world;
+    Collisions collisions;
+
+    /// Add a particle with gravity, returns its offset
+    unsigned addParticle(const Vec3& x, num m);
+    /// Add a horizontal chain of n particles linked by distance constraints, the first one is fixed at origin
+    void addChain(unsigned n, const Vec3& origin);
+    /// Add n colliding spheres dropped into the box of the game
+    void addBallPit(unsigned n);
+    /// Add a horizontal square cloth of about n particles connected by springs, held at two corners
+    void addSpringMesh(unsigned n, const Vec3& origin);
+};
+//---------------------------------------------------------------------------
+/// A parameterized scenario, builds a scene of about size particles
+struct ScenarioType {
+    std::string_view name;
+    void (*build)(Scenario& scenario, unsigned size);
+};
+/// Chains, ball pit, spring mesh and a scene mixing all three
+std::span<const ScenarioType> getScenarioTypes();
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
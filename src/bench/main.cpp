@@ -0,0 +1,214 @@
+#include "bench/Scenario.hpp"
+#include "math/Allocation.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+
+using namespace std;
+using namespace physman;
+
+namespace {
+
+struct Options {
+    vector<string_view> scenarios;
+    vector<unsigned> sizes;
+    vector<unsigned> threads;
+    unsigned steps = 200;
+    unsigned warmup = 20;
+    num step = 1.0 / 64;
+    math::Integrator integrator = math::Integrator::RK4;
+    /// Solve the constraint forces with Physics::mixedPrecision
+    bool mixed = false;
+};
+
+struct IntegratorName {
+    string_view name;
+    math::Integrator integrator;
+};
+constexpr IntegratorName integratorNames[] = {
+    {"euler", math::Integrator::SymplecticEuler},
+    {"verlet", math::Integrator::VelocityVerlet},
+    {"rk2", math::Integrator::RK2},
+    {"rk4", math::Integrator::RK4},
+    {"dopri", math::Integrator::DormandPrince},
+};
+
+void usage() {
+    fmt::print(stderr,
+               "usage: bench [--scenario NAME]... [--size N]... [--threads T]... [--steps S] [--warmup S] [--integrator NAME] [--solver cg|mixed]\n"
+               "Runs every combination of scenario, size and thread count and prints the results as JSON.\n"
+               "Scenarios: chain, ballpit, springmesh, mixed. Integrators: euler, verlet, rk2, rk4, dopri. Threads 0 uses all hardware threads.\n"
+               "Solver mixed refines conjugate gradients on a float copy of the Jacobian\n");
+    exit(1);
+}
+
+Options parseOptions(int argc, const char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        string_view arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        string_view value = argv[++i];
+        auto number = [&] { return static_cast<unsigned>(strtoul(value.data(), nullptr, 10)); };
+        if (arg == "--scenario") {
+            options.scenarios.push_back(value);
+        } else if (arg == "--size") {
+            options.sizes.push_back(number());
+        } else if (arg == "--threads") {
+            options.threads.push_back(number());
+        } else if (arg == "--steps") {
+            // The results are averages over the measured steps
+            options.steps = number();
+            if (options.steps < 1)
+                usage();
+        } else if (arg == "--warmup") {
+            options.warmup = number();
+        } else if (arg == "--integrator") {
+            auto it = ranges::find(integratorNames, value, &IntegratorName::name);
+            if (it == end(integratorNames))
+                usage();
+            options.integrator = it->integrator;
+        } else if (arg == "--solver") {
+            if (value != "cg" && value != "mixed")
+                usage();
+            options.mixed = value == "mixed";
+        } else {
+            usage();
+        }
+    }
+    if (options.scenarios.empty())
+        for (auto& type : bench::getScenarioTypes())
+            options.scenarios.push_back(type.name);
+    if (options.sizes.empty())
+        options.sizes = {100, 1000};
+    if (options.threads.empty())
+        options.threads = {1, 0};
+    for (auto& threads : options.threads)
+        if (!threads)
+            threads = max(thread::hardware_concurrency(), 1u);
+    return options;
+}
+
+/// Totals over the measured steps
+struct Measurement {
+    double contactSeconds = 0;
+    double stepSeconds = 0;
+    math::PhysicsStats::Phases phases;
+    size_t substeps = 0;
+    size_t rejected = 0;
+    size_t solves = 0;
+    size_t cgIterations = 0;
+    size_t unconverged = 0;
+    num maxResidual = 0;
+    size_t nonzeros = 0;
+    size_t constraints = 0;
+    size_t contacts = 0;
+    size_t allocations = 0;
+    size_t arenaBytes = 0;
+    /// At the end of the run
+    size_t forces = 0;
+    size_t islands = 0;
+    size_t arenaPeak = 0;
+};
+
+Measurement run(const bench::ScenarioType& type, unsigned size, unsigned threads, const Options& options) {
+    bench::Scenario scenario;
+    type.build(scenario, size);
+    auto& world = scenario.world;
+    world.setThreadCount(threads);
+    // The integrator of the game by default. With dopri, substeps go down to 1/64 of a step and centimeter accuracy
+    world.integrator = options.integrator;
+    world.mixedPrecision = options.mixed;
+    world.adaptiveOptions.maxStep = options.step;
+    world.adaptiveOptions.minStep = options.step / 64;
+    world.adaptiveOptions.absTolerance = 1e-2;
+    world.adaptiveOptions.relTolerance = 1e-2;
+
+    Measurement m;
+    using clock = chrono::steady_clock;
+    for (unsigned i = 0; i < options.warmup + options.steps; i++) {
+        bool measured = i >= options.warmup;
+        auto allocations = math::allocationCount();
+        auto start = clock::now();
+        auto contacts = scenario.collisions.addContacts(world);
+        auto afterContacts = clock::now();
+        auto odeStats = world.step(options.step);
+        auto end = clock::now();
+        if (!measured)
+            continue;
+        m.allocations += math::allocationCount() - allocations;
+        m.contactSeconds += chrono::duration<double>(afterContacts - start).count();
+        m.stepSeconds += chrono::duration<double>(end - afterContacts).count();
+        m.substeps += odeStats.steps;
+        m.rejected += odeStats.rejected;
+        auto& stats = world.getStats();
+        m.solves += stats.solves;
+        m.cgIterations += stats.cgIterations;
+        m.unconverged += stats.unconverged;
+        m.nonzeros += stats.nonzeros;
+        auto& p = stats.seconds;
+        m.phases.pattern += p.pattern;
+        m.phases.forces += p.forces;
+        m.phases.constraints += p.constraints;
+        m.phases.rhs += p.rhs;
+        m.phases.solve += p.solve;
+        m.phases.solveProducts += p.solveProducts;
+        m.phases.solvePreconditioner += p.solvePreconditioner;
+        m.phases.sleep += p.sleep;
+        m.maxResidual = max(m.maxResidual, stats.maxResidual);
+        m.constraints += world.numConstraints();
+        m.contacts += contacts;
+        m.arenaBytes += stats.arenaBytes;
+    }
+    m.forces = world.numForces();
+    m.islands = world.numIslands();
+    m.arenaPeak = world.getStats().arenaPeak;
+    return m;
+}
+
+}
+
+int main(int argc, const char* argv[])
+// Headless benchmark of the simulation core, one JSON object per run
+{
+    auto options = parseOptions(argc, argv);
+    auto name = ranges::find(integratorNames, options.integrator, &IntegratorName::integrator)->name;
+    fmt::print("{{\"hardwareThreads\": {}, \"step\": {}, \"steps\": {}, \"integrator\": \"{}\", \"solver\": \"{}\", \"scalar\": \"{}\", \"results\": [", thread::hardware_concurrency(), options.step, options.steps, name,
+               options.mixed ? "mixed" : "cg", sizeof(num) == sizeof(float) ? "float" : "double");
+    bool first = true;
+    for (auto scenarioName : options.scenarios) {
+        auto types = bench::getScenarioTypes();
+        auto type = ranges::find(types, scenarioName, &bench::ScenarioType::name);
+        if (type == types.end())
+            usage();
+        for (auto size : options.sizes) {
+            for (auto threads : options.threads) {
+                auto m = run(*type, size, threads, options);
+                double steps = options.steps;
+                auto seconds = m.contactSeconds + m.stepSeconds;
+                auto& p = m.phases;
+                fmt::print("{}\n  {{\"scenario\": \"{}\", \"size\": {}, \"threads\": {}, \"stepsPerSecond\": {:.3f}, "
+                           "\"phaseSeconds\": {{\"contacts\": {:.9f}, \"step\": {:.9f}, \"pattern\": {:.9f}, \"forces\": {:.9f}, \"constraints\": {:.9f}, \"rhs\": {:.9f}, "
+                           "\"solve\": {:.9f}, \"solveProducts\": {:.9f}, \"solvePreconditioner\": {:.9f}, \"sleep\": {:.9f}}}, "
+                           "\"substeps\": {:.3f}, \"rejectedSubsteps\": {:.3f}, \"solves\": {:.3f}, \"cgIterations\": {:.3f}, \"unconvergedSolves\": {:.3f}, \"maxResidual\": {:.3g}, "
+                           "\"constraints\": {:.3f}, \"contacts\": {:.3f}, \"nonzeros\": {:.3f}, \"forces\": {}, \"islands\": {}, \"allocations\": {:.3f}, "
+                           "\"arenaBytes\": {:.3f}, \"arenaPeak\": {}}}",
+                           first ? "" : ",", type->name, size, threads, seconds > 0 ? steps / seconds : 0.0,
+                           m.contactSeconds / steps, m.stepSeconds / steps, p.pattern / steps, p.forces / steps, p.constraints / steps, p.rhs / steps,
+                           p.solve / steps, p.solveProducts / steps, p.solvePreconditioner / steps, p.sleep / steps,
+                           m.substeps / steps, m.rejected / steps, m.solves / steps, m.cgIterations / steps, m.unconverged / steps, m.maxResidual,
+                           m.constraints / steps, m.contacts / steps, m.nonzeros / steps, m.forces, m.islands, m.allocations / steps,
+                           m.arenaBytes / steps, m.arenaPeak);
+                fflush(stdout);
+                first = false;
+            }
+        }
+    }
+    fmt::print("\n]}}\n");
+    return 0;
+}
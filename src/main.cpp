@@ -1,4 +1,5 @@
 #include "Game.hpp"
+#include "math/Trace.hpp"
 #include <raylib.h>
 #include <catch2/catch_session.hpp>
 #if defined(PLATFORM_WEB)
@@ -24,6 +25,7 @@ int main(int argc, const char* argv[])
     InitWindow(currentGame->getScreenWidth(), currentGame->getScreenHeight(), title.c_str());
 
     SetTargetFPS(60);
+    math::Trace::nameThread("main");
 #if defined(PLATFORM_WEB)
     emscripten_set_main_loop(UpdateDrawFrame, 0, 1);
 #else
@@ -31,11 +33,14 @@ int main(int argc, const char* argv[])
         UpdateDrawFrame();
     }
 #endif
+    // The game owns GPU resources, which need the window
+    currentGame.reset();
     CloseWindow();
     return 0;
 }
 
 void UpdateDrawFrame() {
+    math::TraceScope trace("frame");
     double deltaTime = GetFrameTime();
     double totalTime = GetTime();
     currentGame->update(deltaTime, totalTime);
@@ -1,4 +1,11 @@
 #include "math/Algorithm.hpp"
+#include "math/JobSystem.hpp"
+#include "math/Simd.hpp"
+#include "math/Stats.hpp"
+#include "math/Trace.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <valarray>
 #include <catch2/catch_approx.hpp>
 #include <catch2/catch_test_macros.hpp>
@@ -7,41 +14,263 @@ using namespace std;
 //---------------------------------------------------------------------------
 namespace physman::math {
 //---------------------------------------------------------------------------
+/// Entries per chunk of the parallel vector operations. Fixed, so that the dot products do not depend on the thread count
+static constexpr size_t vectorGrain = 4096;
+//---------------------------------------------------------------------------
+static void forChunks(JobSystem* jobs, size_t n, tl::function_ref<void(size_t begin, size_t end)> f)
+// Run f over [0, n), in parallel chunks if jobs are given
+{
+    if (jobs)
+        jobs->parallelFor(n, vectorGrain, f);
+    else
+        f(0, n);
+}
+//---------------------------------------------------------------------------
+static num sumChunks(JobSystem* jobs, size_t n, Vec& partials, tl::function_ref<num(size_t begin, size_t end)> f)
+// Sum f over [0, n). With jobs, the chunk results are added in chunk order
+{
+    if (!jobs)
+        return f(0, n);
+    partials.resize(JobSystem::numChunks(n, vectorGrain));
+    jobs->parallelFor(n, vectorGrain, [&](size_t begin, size_t end) { partials[begin / vectorGrain] = f(begin, end); });
+    num sum = 0;
+    for (auto p : partials)
+        sum += p;
+    return sum;
+}
+//---------------------------------------------------------------------------
 Vec Algorithm::ode(const Vec& x, num t, num h, tl::function_ref<Vec(const Vec& x, num t)> f)
 // Given x' = f(x, t), x(t), h, compute x(t + h)
 {
+    OdeWorkspace ws;
+    Vec result = x;
+    ode(result, t, h, [&](const Vec& x, num t, Vec& dx) { dx = f(x, t); }, ws);
+    return result;
+}
+//---------------------------------------------------------------------------
+static OdeStats dormandPrince(Vec& x, num t, num h, Algorithm::Derivative f, OdeWorkspace& ws, const AdaptiveOptions& options)
+// Embedded Runge Kutta 5(4) pair with step size control. The last stage is the first stage of the next substep
+{
+    OdeStats stats;
+    auto end = t + h;
+    auto step = clamp(ws.nextStep > 0 ? ws.nextStep : h, options.minStep, options.maxStep);
+    if (!(ws.cachedBy == Integrator::DormandPrince && ws.cachedT == t && ws.cachedX == x))
+        f(x, t, ws.k1);
+    auto &k1 = ws.k1, &k2 = ws.k2, &k3 = ws.k3, &k4 = ws.k4, &k5 = ws.k5, &k6 = ws.k6, &k7 = ws.k7;
+    while (t < end) {
+        // Do not leave a sliver at the end
+        auto size = end - t <= 1.01 * step ? end - t : step;
+        ws.tmp = x + size * (1.0 / 5) * k1;
+        f(ws.tmp, t + size / 5, k2);
+        ws.tmp = x + size * ((3.0 / 40) * k1 + (9.0 / 40) * k2);
+        f(ws.tmp, t + size * 3 / 10, k3);
+        ws.tmp = x + size * ((44.0 / 45) * k1 - (56.0 / 15) * k2 + (32.0 / 9) * k3);
+        f(ws.tmp, t + size * 4 / 5, k4);
+        ws.tmp = x + size * ((19372.0 / 6561) * k1 - (25360.0 / 2187) * k2 + (64448.0 / 6561) * k3 - (212.0 / 729) * k4);
+        f(ws.tmp, t + size * 8 / 9, k5);
+        ws.tmp = x + size * ((9017.0 / 3168) * k1 - (355.0 / 33) * k2 + (46732.0 / 5247) * k3 + (49.0 / 176) * k4 - (5103.0 / 18656) * k5);
+        f(ws.tmp, t + size, k6);
+        ws.next = x + size * ((35.0 / 384) * k1 + (500.0 / 1113) * k3 + (125.0 / 192) * k4 - (2187.0 / 6784) * k5 + (11.0 / 84) * k6);
+        f(ws.next, t + size, k7);
+
+        // Difference to the embedded 4th order solution, relative to the tolerance
+        num error = 0;
+        for (size_t i = 0; i < x.size(); i++) {
+            num e = size * ((71.0 / 57600) * k1[i] - (71.0 / 16695) * k3[i] + (71.0 / 1920) * k4[i] - (17253.0 / 339200) * k5[i] + (22.0 / 525) * k6[i] - (1.0 / 40) * k7[i]);
+            num scale = options.absTolerance + options.relTolerance * max(std::abs(x[i]), std::abs(ws.next[i]));
+            error = max(error, std::abs(e) / scale);
+        }
+        if (error <= 1 || size <= options.minStep) {
+            swap(x, ws.next);
+            swap(k1, k7);
+            t += size;
+            stats.steps++;
+        } else {
+            stats.rejected++;
+        }
+        num factor = error > 0 ? 0.9 * std::pow(error, -1.0 / 5) : 5.0;
+        step = clamp(size * clamp<num>(factor, 0.2, 5.0), options.minStep, options.maxStep);
+    }
+    ws.nextStep = step;
+    ws.cachedX.assign(x.begin(), x.end());
+    ws.cachedT = t;
+    ws.cachedBy = Integrator::DormandPrince;
+    return stats;
+}
+//---------------------------------------------------------------------------
+OdeStats Algorithm::ode(Vec& x, num t, num h, Derivative f, OdeWorkspace& ws, Integrator integrator, const AdaptiveOptions& adaptive)
+// Given x' = f(x, t), x(t), h, replace x with x(t + h)
+{
+    auto n = x.size() / 2;
+    // Only Dormand-Prince leaves a reusable derivative in k1, the others overwrite it
+    if (integrator != Integrator::DormandPrince)
+        ws.cachedBy = integrator;
+    switch (integrator) {
+        case Integrator::SymplecticEuler: {
+            assert(x.size() % 2 == 0);
+            // Kick the velocities, then drift the positions with the new velocities
+            f(x, t, ws.k1);
+            simd::axpy(h, ws.k1.data() + n, x.data() + n, n);
+            simd::axpy(h, x.data() + n, x.data(), n);
+            return {1, 0};
+        }
+        case Integrator::VelocityVerlet: {
+            assert(x.size() % 2 == 0);
+            // The accelerations at the end of the previous step saw the half step velocities, so they are not the ones at x
+            f(x, t, ws.k1);
+            for (size_t i = 0; i < n; i++) {
+                x[i] += h * x[n + i] + h * h / 2 * ws.k1[n + i];
+                x[n + i] += h / 2 * ws.k1[n + i];
+            }
+            // Velocity dependent forces see the half step velocities
+            f(x, t + h, ws.k1);
+            simd::axpy(h / 2, ws.k1.data() + n, x.data() + n, n);
+            return {1, 0};
+        }
+        case Integrator::RK2: {
+            f(x, t, ws.k1);
+            ws.tmp = x + (h / 2) * ws.k1;
+            f(ws.tmp, t + h / 2, ws.k2);
+            x += h * ws.k2;
+            return {1, 0};
+        }
+        case Integrator::RK4: break;
+        case Integrator::DormandPrince: return dormandPrince(x, t, h, f, ws, adaptive);
+    }
     // Do Runge Kutta
-    auto k1 = h * f(x, t);
-    auto k2 = h * f(x + k1 / 2, t + h / 2);
-    auto k3 = h * f(x + k2 / 2, t + h / 2);
-    auto k4 = h * f(x + k3, t + h);
-    return x + (num{1} / 6) * k1 + (num{1} / 3) * k2 + (num{1} / 3) * k3 + (num{1} / 6) * k4;
+    f(x, t, ws.k1);
+    ws.tmp = x + (h / 2) * ws.k1;
+    f(ws.tmp, t + h / 2, ws.k2);
+    ws.tmp = x + (h / 2) * ws.k2;
+    f(ws.tmp, t + h / 2, ws.k3);
+    ws.tmp = x + h * ws.k3;
+    f(ws.tmp, t + h, ws.k4);
+    x += (h / 6) * (ws.k1 + 2 * ws.k2 + 2 * ws.k3 + ws.k4);
+    return {1, 0};
 }
 //---------------------------------------------------------------------------
-Vec Algorithm::solve(const Vec& b, tl::function_ref<Vec(const Vec& )> A)
+SolveResult Algorithm::solve(const Vec& b, tl::function_ref<Vec(const Vec&)> A, const SolveOptions& options)
 // Solve Ax = b for x given a function for computing Ax
 {
-    auto x = b;
-    Vec r = b - A(x);
-    Vec d = r;
-    auto rdotr = (r * r).sum();
+    return solve(b, A, [](const Vec& r) { return r; }, options);
+}
+//---------------------------------------------------------------------------
+SolveResult Algorithm::solve(const Vec& b, tl::function_ref<Vec(const Vec&)> A, tl::function_ref<Vec(const Vec&)> M, const SolveOptions& options)
+// Solve Ax = b for x given functions for computing Ax and applying the preconditioner M^-1 r
+{
+    SolveResult result;
+    SolveWorkspace ws;
+    static_cast<SolveStats&>(result) = solve(b, result.x, [&](const Vec& x, Vec& out) { out = A(x); }, [&](const Vec& r, Vec& out) { out = M(r); }, options, ws);
+    return result;
+}
+//---------------------------------------------------------------------------
+SolveStats Algorithm::solve(const Vec& b, Vec& x, Operator A, Operator M, const SolveOptions& options, SolveWorkspace& ws, JobSystem* jobs)
+// Solve Ax = b with preconditioned conjugate gradients
+{
+    TraceScope trace("cg");
+    auto n = b.size();
+    SolveStats result;
+    x.assign(n, 0);
+    auto dot = [&](const Vec& u, const Vec& v) {
+        return sumChunks(jobs, n, ws.partials, [&](size_t begin, size_t end) { return simd::dot(u.data() + begin, v.data() + begin, end - begin); });
+    };
+    auto bnorm = std::sqrt(dot(b, b));
+    if (bnorm == 0) {
+        result.converged = true;
+        return result;
+    }
 
-    size_t iterations = 0;
-    size_t maxIterations = 100;
-    while (rdotr >= (num{1} / 100000) && iterations < maxIterations) {
-        iterations++;
-        auto Ad = A(d);
-        auto alpha = rdotr / (d * Ad).sum();
-        x += alpha * d;
-        r -= alpha * Ad;
-        auto rdotrOld = rdotr;
-        rdotr = (r * r).sum();
-        auto beta = rdotr / rdotrOld;
-        d *= beta;
-        d += r;
+    auto& r = ws.r;
+    auto& z = ws.z;
+    auto& d = ws.d;
+    auto& Ad = ws.Ad;
+    r.assign(b.begin(), b.end());
+    z.resize(n);
+    Ad.resize(n);
+    auto applyA = [&](const Vec& x, Vec& out) {
+        ScopedTimer timer(result.productSeconds);
+        A(x, out);
+    };
+    auto applyM = [&](const Vec& r, Vec& out) {
+        ScopedTimer timer(result.preconditionerSeconds);
+        M(r, out);
+    };
+    applyM(r, z);
+    d.assign(z.begin(), z.end());
+    auto rdotz = dot(r, z);
+    auto rnorm = bnorm;
+
+    while (true) {
+        result.converged = rnorm <= options.tolerance * bnorm;
+        if (result.converged || result.iterations >= options.maxIterations)
+            break;
+        result.iterations++;
+        applyA(d, Ad);
+        auto dAd = dot(d, Ad);
+        // Breakdown, d is in the null space of A
+        if (dAd == 0)
+            break;
+        auto alpha = rdotz / dAd;
+        // x += alpha d, r -= alpha Ad and |r|^2 in one pass
+        rnorm = std::sqrt(sumChunks(jobs, n, ws.partials, [&](size_t begin, size_t end) {
+            simd::axpy(alpha, d.data() + begin, x.data() + begin, end - begin);
+            simd::axpy(-alpha, Ad.data() + begin, r.data() + begin, end - begin);
+            return simd::dot(r.data() + begin, r.data() + begin, end - begin);
+        }));
+        applyM(r, z);
+        auto rdotzOld = rdotz;
+        rdotz = dot(r, z);
+        auto beta = rdotz / rdotzOld;
+        forChunks(jobs, n, [&](size_t begin, size_t end) { simd::aypx(beta, z.data() + begin, d.data() + begin, end - begin); });
+    }
+    result.residual = rnorm / bnorm;
+    return result;
+}
+//---------------------------------------------------------------------------
+SolveStats Algorithm::solveRefined(const Vec& b, Vec& x, Operator A, Operator approxA, Operator M, const SolveOptions& options, SolveWorkspace& ws, JobSystem* jobs)
+// Each inner solve only needs to shrink the current residual by innerTolerance, the outer residual keeps the full precision of A
+{
+    TraceScope trace("refined cg");
+    auto n = b.size();
+    SolveStats result;
+    x.assign(n, 0);
+    auto bnorm = std::sqrt(sumChunks(jobs, n, ws.partials, [&](size_t begin, size_t end) { return simd::dot(b.data() + begin, b.data() + begin, end - begin); }));
+    if (bnorm == 0) {
+        result.converged = true;
+        return result;
     }
 
-    return x;
+    auto& r = ws.residual;
+    auto& d = ws.correction;
+    r.assign(b.begin(), b.end());
+    auto rnorm = bnorm;
+    for (size_t refinement = 0;; refinement++) {
+        result.converged = rnorm <= options.tolerance * bnorm;
+        if (result.converged || refinement >= options.maxRefinements || result.iterations >= options.maxIterations)
+            break;
+        auto inner = options;
+        inner.tolerance = max(options.innerTolerance, options.tolerance * bnorm / rnorm);
+        inner.maxIterations = options.maxIterations - result.iterations;
+        auto stats = solve(r, d, approxA, M, inner, ws, jobs);
+        result.iterations += stats.iterations;
+        result.productSeconds += stats.productSeconds;
+        result.preconditionerSeconds += stats.preconditionerSeconds;
+        if (!stats.iterations)
+            break;
+        forChunks(jobs, n, [&](size_t begin, size_t end) { simd::axpy(1, d.data() + begin, x.data() + begin, end - begin); });
+        // r = b - Ax, d is no longer needed and holds Ax
+        {
+            ScopedTimer timer(result.productSeconds);
+            A(x, d);
+        }
+        rnorm = std::sqrt(sumChunks(jobs, n, ws.partials, [&](size_t begin, size_t end) {
+            for (auto i = begin; i < end; i++)
+                r[i] = b[i] - d[i];
+            return simd::dot(r.data() + begin, r.data() + begin, end - begin);
+        }));
+    }
+    result.residual = rnorm / bnorm;
+    return result;
 }
 //---------------------------------------------------------------------------
 TEST_CASE("math/Algorithm::ode") {
@@ -49,30 +278,156 @@ TEST_CASE("math/Algorithm::ode") {
     // x0 = 1
     // x' = x;
     // x = e^t
-    REQUIRE(Algorithm::ode({1.0}, 0.0, 0.5, [](const Vec& x, num t) {
+    REQUIRE(Algorithm::ode({1.0}, 0.0, 0.5, [](const Vec& x, [[maybe_unused]] num t) {
         return x;
     })[0] == Approx(exp(0.5)).epsilon(0.1));
     // x0 = 1
     // x' = 1;
     // x = t + 1;
-    REQUIRE(Algorithm::ode({1.0}, 0.0, 0.5, [](const Vec& x, num t) -> Vec {
+    REQUIRE(Algorithm::ode({1.0}, 0.0, 0.5, []([[maybe_unused]] const Vec& x, [[maybe_unused]] num t) -> Vec {
                 return {1};
             })[0] == Approx(0.5 + 1).epsilon(0.1));
+
+    // Harmonic oscillator x'' = -x, one period. Every integrator stays close, the symplectic ones keep the energy bounded
+    for (auto integrator : {Integrator::SymplecticEuler, Integrator::VelocityVerlet, Integrator::RK2, Integrator::RK4, Integrator::DormandPrince}) {
+        Vec x{1.0, 0.0};
+        OdeWorkspace ws;
+        unsigned evaluations = 0;
+        auto f = [&](const Vec& x, [[maybe_unused]] num t, Vec& dx) {
+            evaluations++;
+            dx = Vec{x[1], -x[0]};
+        };
+        num h = 0.01;
+        unsigned steps = static_cast<unsigned>(std::round(2 * M_PI / h));
+        num t = 0;
+        for (unsigned i = 0; i < steps; i++, t += h)
+            Algorithm::ode(x, t, h, f, ws, integrator);
+        REQUIRE(x[0] == Approx(1.0).margin(0.02));
+        REQUIRE(x[1] == Approx(0.0).margin(0.02));
+        REQUIRE(x[0] * x[0] + x[1] * x[1] == Approx(1.0).margin(0.02));
+        if (integrator == Integrator::VelocityVerlet)
+            REQUIRE(evaluations == 2 * steps);
+    }
+
+    // A workspace shared between integrators only reuses the derivative Dormand-Prince left for itself
+    {
+        auto f = [](const Vec& x, [[maybe_unused]] num t, Vec& dx) { dx = Vec{x[1], -x[0] - x[1]}; };
+        Vec x{1.0, 0.0}, y{1.0, 0.0};
+        OdeWorkspace ws, fresh;
+        Algorithm::ode(x, 0.0, 0.1, f, ws, Integrator::DormandPrince);
+        Algorithm::ode(y, 0.0, 0.1, f, fresh, Integrator::DormandPrince);
+        Algorithm::ode(x, 0.1, 0.1, f, ws, Integrator::VelocityVerlet);
+        Algorithm::ode(y, 0.1, 0.1, f, fresh, Integrator::VelocityVerlet);
+        fresh = {};
+        fresh.nextStep = ws.nextStep;
+        Algorithm::ode(x, 0.2, 0.1, f, ws, Integrator::DormandPrince);
+        Algorithm::ode(y, 0.2, 0.1, f, fresh, Integrator::DormandPrince);
+        REQUIRE(x == y);
+    }
+
+    // Adaptive substeps: a calm system takes a single step, a fast decay gets as many as the tolerance needs
+    {
+        OdeWorkspace ws;
+        Vec x{1.0};
+        auto stats = Algorithm::ode(x, 0.0, 0.1, []([[maybe_unused]] const Vec& x, [[maybe_unused]] num t, Vec& dx) { dx = Vec{1.0}; }, ws, Integrator::DormandPrince);
+        REQUIRE(stats.steps == 1);
+        REQUIRE(stats.rejected == 0);
+        REQUIRE(x[0] == Approx(1.1));
+
+        OdeWorkspace ws2;
+        Vec y{1.0};
+        stats = Algorithm::ode(y, 0.0, 1.0, [](const Vec& x, [[maybe_unused]] num t, Vec& dx) { dx = -20 * x; }, ws2, Integrator::DormandPrince, {.absTolerance = 1e-8, .relTolerance = 1e-8});
+        REQUIRE(stats.steps > 10);
+        REQUIRE(y[0] == Approx(exp(-20.0)).margin(1e-7));
+        REQUIRE(ws2.nextStep > 0);
+    }
 }
 //---------------------------------------------------------------------------
 TEST_CASE("math/Algorithm::solve") {
     using Catch::Approx;
     // Fibonacci matrix
     {
-        auto v = Algorithm::solve({2, 1}, [&](const Vec& x) -> Vec { return {x[0] + x[1], x[0]}; });
+        auto v = Algorithm::solve({2, 1}, [&](const Vec& x) -> Vec { return {x[0] + x[1], x[0]}; }).x;
         REQUIRE(v[0] == Approx(1.0));
         REQUIRE(v[1] == Approx(1.0));
     }
     {
-        auto v = Algorithm::solve({5, 3}, [&](const Vec& x) -> Vec { return {x[0] + x[1], x[0]}; });
+        auto v = Algorithm::solve({5, 3}, [&](const Vec& x) -> Vec { return {x[0] + x[1], x[0]}; }).x;
         REQUIRE(v[0] == Approx(3.0));
         REQUIRE(v[1] == Approx(2.0));
     }
+    // Badly scaled diagonal system, Jacobi preconditioning solves it in one step
+    {
+        Vec diag{1, 1000, 1e6};
+        auto A = [&](const Vec& x) { return diag * x; };
+        auto res = Algorithm::solve({1, 2000, 3e6}, A, [&](const Vec& r) { return r / diag; });
+        REQUIRE(res.converged);
+        REQUIRE(res.iterations == 1);
+        REQUIRE(res.x[2] == Approx(3.0));
+        REQUIRE(res.residual <= SolveOptions{}.tolerance);
+    }
+    // Iteration limit is reported as not converged
+    {
+        auto res = Algorithm::solve({1, 2, 3}, [&](const Vec& x) -> Vec { return {4 * x[0] + x[1], x[0] + 3 * x[1] + x[2], x[1] + 2 * x[2]}; }, {.tolerance = 1e-12, .maxIterations = 1});
+        REQUIRE(!res.converged);
+        REQUIRE(res.iterations == 1);
+        REQUIRE(res.residual > 1e-12);
+    }
+    // Chunked parallel solve, the result does not depend on the thread count
+    {
+        size_t n = 10000;
+        auto A = [&](const Vec& x, Vec& out) {
+            out.resize(n);
+            for (size_t i = 0; i < n; i++)
+                out[i] = 4 * x[i] - (i ? x[i - 1] : 0) - (i + 1 < n ? x[i + 1] : 0);
+        };
+        auto M = [&](const Vec& r, Vec& z) { z = r / 4.0; };
+        Vec b(n);
+        for (size_t i = 0; i < n; i++)
+            b[i] = std::sin(static_cast<num>(i));
+        SolveWorkspace ws;
+        Vec serial, x;
+        JobSystem one(1), four(4);
+        auto stats = Algorithm::solve(b, serial, A, M, {.tolerance = 1e-10}, ws, &one);
+        REQUIRE(stats.converged);
+        Algorithm::solve(b, x, A, M, {.tolerance = 1e-10}, ws, &four);
+        REQUIRE(x == serial);
+        Algorithm::solve(b, x, A, M, {.tolerance = 1e-10}, ws);
+        for (size_t i = 0; i < n; i++)
+            REQUIRE(x[i] == Approx(serial[i]).margin(1e-8));
+    }
+    // Refinement with an approximate operator still reaches the tolerance of the exact one
+    {
+        size_t n = 1000;
+        auto product = [&](num diagonal, const Vec& x, Vec& out) {
+            out.resize(n);
+            for (size_t i = 0; i < n; i++)
+                out[i] = diagonal * x[i] - (i ? x[i - 1] : 0) - (i + 1 < n ? x[i + 1] : 0);
+        };
+        auto A = [&](const Vec& x, Vec& out) { product(4, x, out); };
+        auto approxA = [&](const Vec& x, Vec& out) { product(4.01, x, out); };
+        auto M = [&](const Vec& r, Vec& z) { z = r / 4.0; };
+        Vec b(n);
+        for (size_t i = 0; i < n; i++)
+            b[i] = std::sin(static_cast<num>(i));
+        SolveWorkspace ws;
+        Vec exact, refined, approximate;
+        Algorithm::solve(b, exact, A, M, {.tolerance = 1e-5}, ws);
+        Algorithm::solve(b, approximate, approxA, M, {.tolerance = 1e-5}, ws);
+        auto stats = Algorithm::solveRefined(b, refined, A, approxA, M, {.tolerance = 1e-5}, ws);
+        REQUIRE(stats.converged);
+        REQUIRE(stats.residual <= 1e-5);
+        num refinedError = 0, approximateError = 0;
+        for (size_t i = 0; i < n; i++) {
+            refinedError = max(refinedError, std::abs(refined[i] - exact[i]));
+            approximateError = max(approximateError, std::abs(approximate[i] - exact[i]));
+        }
+        REQUIRE(refinedError < 0.1 * approximateError);
+        // Too few refinements are reported as not converged
+        stats = Algorithm::solveRefined(b, refined, A, approxA, M, {.tolerance = 1e-5, .maxRefinements = 1}, ws);
+        REQUIRE(!stats.converged);
+        REQUIRE(stats.residual > 1e-5);
+    }
 }
 //---------------------------------------------------------------------------
 }
@@ -2,16 +2,118 @@
 //---------------------------------------------------------------------------
 #include "math/Num.hpp"
 #include "math/Vec.hpp"
+#include <limits>
 #include <tl/function_ref.hpp>
 //---------------------------------------------------------------------------
 namespace physman::math {
 //---------------------------------------------------------------------------
+class JobSystem;
+//---------------------------------------------------------------------------
+/// Options for Algorithm::solve
+struct SolveOptions {
+    /// Stop once |b - Ax| <= tolerance * |b|
+    num tolerance = 1e-5;
+    /// Stop after this many iterations even if not converged
+    size_t maxIterations = 100;
+    /// Relative residual each inner solve of Algorithm::solveRefined aims for
+    num innerTolerance = 1e-3;
+    /// Inner solves of Algorithm::solveRefined at most
+    size_t maxRefinements = 10;
+};
+//---------------------------------------------------------------------------
+/// Convergence of Algorithm::solve
+struct SolveStats {
+    /// Number of iterations used
+    size_t iterations = 0;
+    /// Final relative residual |b - Ax| / |b|
+    num residual = 0;
+    /// Whether the tolerance was reached
+    bool converged = false;
+    /// Seconds spent applying A and the preconditioner, zero without PHYSMAN_STATS
+    double productSeconds = 0;
+    double preconditionerSeconds = 0;
+};
+//---------------------------------------------------------------------------
+/// Result of Algorithm::solve
+struct SolveResult : SolveStats {
+    Vec x;
+};
+//---------------------------------------------------------------------------
+/// Integration scheme of Algorithm::ode
+enum class Integrator {
+    /// Semi-implicit Euler, one evaluation per step. Needs a second order system
+    SymplecticEuler,
+    /// Velocity Verlet, two evaluations per step. Needs a second order system
+    VelocityVerlet,
+    /// Midpoint method, two evaluations per step
+    RK2,
+    /// Classic Runge Kutta, four evaluations per step
+    RK4,
+    /// Dormand-Prince 5(4), splits the step into substeps sized by an estimate of the local error. Six evaluations per substep
+    DormandPrince
+};
+//---------------------------------------------------------------------------
+/// Options for the adaptive integrators of Algorithm::ode
+struct AdaptiveOptions {
+    /// A substep is accepted if the error of every entry is below absTolerance + relTolerance * |x|
+    num absTolerance = 1e-3;
+    num relTolerance = 1e-3;
+    /// Smallest substep, accepted even if it is not accurate enough
+    num minStep = 1e-5;
+    /// Largest substep
+    num maxStep = std::numeric_limits<num>::infinity();
+};
+//---------------------------------------------------------------------------
+/// Substeps taken by Algorithm::ode
+struct OdeStats {
+    /// Accepted substeps
+    size_t steps = 0;
+    /// Substeps that were repeated with a smaller size
+    size_t rejected = 0;
+};
+//---------------------------------------------------------------------------
+/// Buffers of Algorithm::ode, kept across calls so that steady state calls do not allocate
+struct OdeWorkspace {
+    Vec k1, k2, k3, k4, k5, k6, k7, tmp, next;
+    /// State, time and integrator of the last evaluation left in k1, it is reused only if all three match exactly. Set cachedT to NaN when the derivative function changes
+    Vec cachedX;
+    num cachedT = std::numeric_limits<num>::quiet_NaN();
+    Integrator cachedBy = Integrator::DormandPrince;
+    /// Substep size the adaptive integrators start with in the next call, 0 uses the whole step
+    num nextStep = 0;
+};
+//---------------------------------------------------------------------------
+/// Buffers of Algorithm::solve, kept across calls so that steady state calls do not allocate
+struct SolveWorkspace {
+    Vec r, z, d, Ad;
+    /// Per chunk sums of the parallel dot products
+    Vec partials;
+    /// Outer residual and correction of Algorithm::solveRefined
+    Vec residual, correction;
+};
+//---------------------------------------------------------------------------
 class Algorithm {
     public:
+    /// Derivative function, writes x' = f(x, t) into dx
+    using Derivative = tl::function_ref<void(const Vec& x, num t, Vec& dx)>;
+    /// Linear operator, writes Ax into out
+    using Operator = tl::function_ref<void(const Vec& x, Vec& out)>;
+
     /// Given x' = f(x, t), x(t), h, compute x(t + h)
     static Vec ode(const Vec& x, num t, num h, tl::function_ref<Vec(const Vec& x, num t)> f);
-    /// Solve Ax = b for x given a function for computing Ax
-    static Vec solve(const Vec& b, tl::function_ref<Vec(const Vec& x)> A);
+    /// Given x' = f(x, t), x(t), h, replace x with x(t + h).
+    /// The symplectic integrators need x = [positions, velocities] and f = [velocities, accelerations] of equal length
+    static OdeStats ode(Vec& x, num t, num h, Derivative f, OdeWorkspace& ws, Integrator integrator = Integrator::RK4, const AdaptiveOptions& adaptive = {});
+    /// Solve Ax = b for x given a function for computing Ax. A must be symmetric positive (semi-)definite
+    static SolveResult solve(const Vec& b, tl::function_ref<Vec(const Vec& x)> A, const SolveOptions& options = {});
+    /// Solve Ax = b for x given functions for computing Ax and applying the preconditioner M^-1 r
+    static SolveResult solve(const Vec& b, tl::function_ref<Vec(const Vec& x)> A, tl::function_ref<Vec(const Vec& r)> M, const SolveOptions& options = {});
+    /// Solve Ax = b for x given operators for computing Ax and applying the preconditioner M^-1 r.
+    /// With jobs, the vector updates and dot products are split into fixed chunks over the threads, the result does not depend on the thread count
+    static SolveStats solve(const Vec& b, Vec& x, Operator A, Operator M, const SolveOptions& options, SolveWorkspace& ws, JobSystem* jobs = nullptr);
+    /// Solve Ax = b by iterative refinement: conjugate gradients on a cheaper approximation approxA, e.g. with low precision matrix values, solve for corrections of the residual b - Ax computed with A.
+    /// Reaches the tolerance of A as long as approxA is close enough for the inner solves to make progress. The iterations are summed over the inner solves
+    static SolveStats solveRefined(const Vec& b, Vec& x, Operator A, Operator approxA, Operator M, const SolveOptions& options, SolveWorkspace& ws, JobSystem* jobs = nullptr);
 };
 //---------------------------------------------------------------------------
 }
@@ -0,0 +1,33 @@
+#include "math/Allocation.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+static atomic<size_t> allocations{0};
+//---------------------------------------------------------------------------
+size_t allocationCount() {
+    return allocations.load(memory_order_relaxed);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#ifdef PHYSMAN_COUNT_ALLOCATIONS
+// Replace the global allocation functions to count allocations. The other variants forward to these.
+void* operator new(size_t size) {
+    physman::math::allocations.fetch_add(1, memory_order_relaxed);
+    if (auto* p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc{};
+}
+void operator delete(void* p) noexcept {
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#endif
+//---------------------------------------------------------------------------
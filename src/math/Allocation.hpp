@@ -0,0 +1,17 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <cstddef>
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Whether operator new counts allocations. PHYSMAN_COUNT_ALLOCATIONS replaces the global operator new, which adds an atomic increment to every allocation of the program
+#ifdef PHYSMAN_COUNT_ALLOCATIONS
+inline constexpr bool allocationsCounted = true;
+#else
+inline constexpr bool allocationsCounted = false;
+#endif
+/// Number of heap allocations done through operator new since program start, for all threads. Always 0 without PHYSMAN_COUNT_ALLOCATIONS
+size_t allocationCount();
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
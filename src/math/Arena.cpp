@@ -0,0 +1,115 @@
+#include "math/Arena.hpp"
+#include "math/Allocation.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <numeric>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+void* Arena::allocateBytes(size_t bytes, size_t alignment)
+// Take the bytes from the current block, move on to the next one if they do not fit. The space left in a block is only reused after a reset
+{
+    assert(alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    while (true) {
+        if (current < blocks.size()) {
+            auto& block = blocks[current];
+            auto start = (offset + alignment - 1) & ~(alignment - 1);
+            if (start + bytes <= block.size) {
+                used += start - offset + bytes;
+                peak = max(peak, used);
+                offset = start + bytes;
+                return block.data.get() + start;
+            }
+            if (current + 1 < blocks.size()) {
+                current++;
+                offset = 0;
+                continue;
+            }
+        }
+        // Grow geometrically, so that a growing scene needs few allocations until the next reset merges the blocks
+        auto size = max({bytes, minBlockSize, getCapacity()});
+        blocks.push_back({make_unique_for_overwrite<byte[]>(size), size});
+        current = blocks.size() - 1;
+        offset = 0;
+    }
+}
+//---------------------------------------------------------------------------
+void Arena::reset() {
+    if (blocks.size() > 1) {
+        auto size = getCapacity();
+        blocks.clear();
+        blocks.push_back({make_unique_for_overwrite<byte[]>(size), size});
+    }
+    current = 0;
+    offset = 0;
+    used = 0;
+}
+//---------------------------------------------------------------------------
+void Arena::reserve(size_t bytes)
+// The new block is merged with the others at the next reset, right away if nothing is in use
+{
+    auto capacity = getCapacity();
+    if (bytes > capacity)
+        blocks.push_back({make_unique_for_overwrite<byte[]>(bytes - capacity), bytes - capacity});
+    if (!used)
+        reset();
+}
+//---------------------------------------------------------------------------
+size_t Arena::getCapacity() const {
+    return accumulate(blocks.begin(), blocks.end(), size_t(0), [](size_t sum, const Block& block) { return sum + block.size; });
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Arena") {
+    Arena arena;
+    REQUIRE(arena.getCapacity() == 0);
+    auto a = arena.allocate<unsigned>(10, 7u);
+    auto b = arena.allocate<double>(3);
+    REQUIRE(a.size() == 10);
+    REQUIRE(ranges::count(a, 7u) == 10);
+    REQUIRE(ranges::count(b, 0.0) == 3);
+    REQUIRE(reinterpret_cast<uintptr_t>(b.data()) % alignof(double) == 0);
+    // No overlap
+    REQUIRE(reinterpret_cast<const byte*>(b.data()) >= reinterpret_cast<const byte*>(a.data() + a.size()));
+    REQUIRE(arena.getUsed() >= 10 * sizeof(unsigned) + 3 * sizeof(double));
+
+    // Growing past the first block keeps the earlier allocations valid
+    auto big = arena.allocate<char>(2 * Arena::minBlockSize, 'x');
+    REQUIRE(big.size() == 2 * Arena::minBlockSize);
+    REQUIRE(ranges::count(a, 7u) == 10);
+    auto peak = arena.getUsed();
+    REQUIRE(arena.getPeak() == peak);
+    REQUIRE(arena.getCapacity() >= peak);
+
+    // After a reset the same allocations fit into one block without touching the heap
+    arena.reset();
+    REQUIRE(arena.getUsed() == 0);
+    REQUIRE(arena.getPeak() == peak);
+    auto capacity = arena.getCapacity();
+    auto before = allocationCount();
+    for (unsigned i = 0; i < 3; i++) {
+        arena.allocate<unsigned>(10);
+        arena.allocate<double>(3);
+        arena.allocate<char>(2 * Arena::minBlockSize);
+        arena.reset();
+    }
+    REQUIRE(allocationCount() == before);
+    REQUIRE(arena.getCapacity() == capacity);
+    REQUIRE(arena.getPeak() == peak);
+
+    // Reserving up front
+    Arena reserved;
+    reserved.reserve(1000);
+    REQUIRE(reserved.getCapacity() == 1000);
+    before = allocationCount();
+    reserved.allocate<double>(100);
+    reserved.allocate<unsigned>(50);
+    REQUIRE(allocationCount() == before);
+    REQUIRE(reserved.getCapacity() == 1000);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
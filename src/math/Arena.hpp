@@ -0,0 +1,59 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Monotonic allocator for temporaries that only live until the next reset, e.g. during one physics step.
+/// Reset keeps the memory, so that once the arena is large enough it does not allocate anymore. Not thread safe
+class Arena {
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size = 0;
+    };
+    std::vector<Block> blocks;
+    /// Block that is allocated from and the bytes used in it
+    size_t current = 0;
+    size_t offset = 0;
+    /// Bytes handed out since the last reset, including alignment padding
+    size_t used = 0;
+    /// Most bytes used between two resets
+    size_t peak = 0;
+
+    void* allocateBytes(size_t bytes, size_t alignment);
+
+    public:
+    /// Smallest block that is allocated when the arena grows
+    static constexpr size_t minBlockSize = size_t(64) << 10;
+
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /// Get count values initialized to value, valid until the next reset
+    template <typename T>
+        requires std::is_trivially_destructible_v<T>
+    std::span<T> allocate(size_t count, const T& value = T{}) {
+        auto* data = static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+        std::uninitialized_fill_n(data, count, value);
+        return {data, count};
+    }
+    /// Release all allocations. Memory spread over several blocks is merged into one block
+    void reset();
+    /// Make sure that the given number of bytes fit without allocating
+    void reserve(size_t bytes);
+
+    /// Bytes used since the last reset
+    size_t getUsed() const { return used; }
+    /// Most bytes used between two resets, for sizing the arena with reserve
+    size_t getPeak() const { return peak; }
+    /// Bytes allocated from the system
+    size_t getCapacity() const;
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -14,7 +14,7 @@ const Constraint* math::Constraint::getDistance1()
         val::Vec3 x2{ox, oy, oz};
         auto distVec = x1 - x2;
         auto dist = (distVec * distVec).sum() - (expectedDist * expectedDist);
-        return makeConstraint(dist);
+        return makeConstraint("distance1", dist);
     }();
     return &myConstraint;
 }
@@ -26,7 +26,7 @@ const Constraint* math::Constraint::getDistance2()
         auto [t, x1, x2, v1, v2, expectedDist] = makeVecComponents<2, 1>();
         auto distVec = x1 - x2;
         auto dist = (distVec * distVec).sum() - (expectedDist * expectedDist);
-        return makeConstraint(dist);
+        return makeConstraint("distance2", dist);
     }();
     return &myConstraint;
 }
@@ -38,7 +38,7 @@ const Constraint* math::Constraint::getFixed()
         auto [t, x1, v1, x, y, z] = makeVecComponents<1, 3>();
         auto distVec = x1 - val::Vec3{x, y, z};
         auto dist = (distVec * distVec).sum();
-        return makeConstraint(dist);
+        return makeConstraint("fixed", dist);
     }();
     return &myConstraint;
 }
@@ -52,7 +52,7 @@ const Constraint* math::Constraint::getSphereCollision1()
     auto distVec = x1 - x2;
     auto dist = (distVec * distVec).sum() - (expectedDist * expectedDist);
     auto dif = val::If{[](num v) { return v < -epsilon; }, dist, dist, val::Zero{}};
-    return makeConstraint(dif);
+    return makeConstraint("sphereCollision1", dif);
     }();
     return &myConstraint;
 }
@@ -65,7 +65,7 @@ const Constraint* math::Constraint::getSphereCollision2()
         auto distVec = x1 - x2;
         auto dist = (distVec * distVec).sum() - (expectedDist * expectedDist);
         auto dif = val::If{[](num v) { return v < -epsilon; }, dist, dist, val::Zero{}};
-        return makeConstraint(dif);
+        return makeConstraint("sphereCollision2", dif);
     }();
     return &myConstraint;
 }
@@ -79,12 +79,12 @@ const Constraint* math::Constraint::getPlaneCollision1()
         // Up should already be normalized
         auto dist = (up * x1).sum() - expectedDist;
         auto dif = val::If{[](num v) { return v < -epsilon; }, dist, dist, val::Zero{}};
-        return makeConstraint(dif);
+        return makeConstraint("planeCollision1", dif);
     }();
     return &myConstraint;
 }
 //---------------------------------------------------------------------------
-ValScope Constraint::map(const ValScope& source, std::span<const unsigned> components, unsigned paramStart, unsigned paramCount)
+ValScope Constraint::map(const ValScope& source, std::span<const unsigned> components, std::span<const num> params)
 // Extract specific components from larger valscope
 {
     ValScope result;
@@ -95,10 +95,28 @@ ValScope Constraint::map(const ValScope& source, std::span<const unsigned> compo
         result.xs[i] = source.xs[components[i]];
         result.vs[i] = source.vs[components[i]];
     }
-    result.ps = source.ps.slice(paramStart, paramCount);
+    result.ps.assign(params.begin(), params.end());
     return result;
 }
 //---------------------------------------------------------------------------
+void Constraint::gather(std::span<const num> sourceXs, std::span<const num> sourceVs, std::span<const unsigned> components, unsigned componentCount, std::span<const num> params, unsigned paramCount, Vec& xs, Vec& vs, Vec& ps)
+// Gather the components and parameters of many instances into structure of arrays layout
+{
+    auto count = componentCount ? components.size() / componentCount : params.size() / paramCount;
+    xs.resize(components.size());
+    vs.resize(components.size());
+    ps.resize(params.size());
+    for (size_t i = 0; i < count; i++) {
+        for (unsigned k = 0; k < componentCount; k++) {
+            auto c = components[i * componentCount + k];
+            xs[k * count + i] = sourceXs[c];
+            vs[k * count + i] = sourceVs[c];
+        }
+        for (unsigned k = 0; k < paramCount; k++)
+            ps[k * count + i] = params[i * paramCount + k];
+    }
+}
+//---------------------------------------------------------------------------
 TEST_CASE("math/Constraint") {
     using Catch::Approx;
     ValScope vs;
@@ -109,6 +127,65 @@ TEST_CASE("math/Constraint") {
     auto cs = Constraint::getDistance2();
     REQUIRE(cs->computeC(vs) == Approx(0.0));
     REQUIRE(cs->computeC_dt(vs) == Approx(12.0));
+    // C' = 2 (x1 - x2) (v1 - v2), so dC' / dx1 = 2 (v1 - v2) = (-4, 0, 0) and dC' / dx2 = (4, 0, 0)
+    {
+        auto J_dt = cs->computeJacobian_dt(vs);
+        num expected[] = {-4.0, 0.0, 0.0, 4.0, 0.0, 0.0};
+        for (unsigned k = 0; k < 6; k++)
+            REQUIRE(J_dt[k] == Approx(expected[k]));
+    }
+
+    // The batch kernel matches the single instance functions
+    unsigned components[] = {0, 1, 2, 3, 4, 5, 3, 4, 5, 0, 1, 2};
+    num params[] = {3.0, 2.0};
+    Vec xs, vs2, ps;
+    Constraint::gather(vs.xs, vs.vs, components, 6, params, 1, xs, vs2, ps);
+    BatchScope batch{xs.data(), vs2.data(), ps.data(), 0.0, 2};
+    Vec C(2), C_dt(2), J(12);
+    cs->computeBatch(batch, C, C_dt, J);
+    for (unsigned i = 0; i < 2; i++) {
+        auto mapped = Constraint::map(vs, span{components}.subspan(i * 6, 6), span{params}.subspan(i, 1));
+        REQUIRE(C[i] == Approx(cs->computeC(mapped)));
+        REQUIRE(C_dt[i] == Approx(cs->computeC_dt(mapped)));
+        auto localJ = cs->computeJacobian(mapped);
+        for (unsigned k = 0; k < 6; k++)
+            REQUIRE(J[i * 6 + k] == Approx(localJ[k]));
+    }
+    REQUIRE(C[1] == Approx(9.0 - 4.0));
+    REQUIRE(J[3] == Approx(2 * 3.0));
+
+    // Full packs plus a remainder, with lanes on both sides of the collision condition
+    {
+        auto sphere = Constraint::getSphereCollision2();
+        ValScope line;
+        vector<unsigned> pairs;
+        vector<num> radii;
+        unsigned particles = packWidth + 3;
+        for (unsigned i = 0; i < particles; i++) {
+            line.xs.insert(line.xs.end(), {i * num(0.7), 0.0, 0.0});
+            line.vs.insert(line.vs.end(), {0.0, i * num(0.1), 0.0});
+        }
+        for (unsigned i = 0; i + 1 < particles; i++) {
+            for (unsigned k = 0; k < 6; k++)
+                pairs.push_back(i * 3 + k);
+            radii.push_back(i % 2 ? 1.0 : 0.5);
+        }
+        auto count = radii.size();
+        Constraint::gather(line.xs, line.vs, pairs, 6, radii, 1, xs, vs2, ps);
+        BatchScope batch{xs.data(), vs2.data(), ps.data(), 0.0, count};
+        Vec C(count), C_dt(count), J(count * 6);
+        sphere->computeBatch(batch, C, C_dt, J);
+        for (unsigned i = 0; i < count; i++) {
+            auto mapped = Constraint::map(line, span{pairs}.subspan(i * 6, 6), span{radii}.subspan(i, 1));
+            REQUIRE(C[i] == Approx(sphere->computeC(mapped)));
+            REQUIRE(C_dt[i] == Approx(sphere->computeC_dt(mapped)));
+            auto localJ = sphere->computeJacobian(mapped);
+            for (unsigned k = 0; k < 6; k++)
+                REQUIRE(J[i * 6 + k] == Approx(localJ[k]));
+        }
+        REQUIRE(C[0] == Approx(0.0));
+        REQUIRE(C[1] < 0);
+    }
 }
 //---------------------------------------------------------------------------
 }
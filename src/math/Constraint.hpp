@@ -3,7 +3,12 @@
 #include "math/Num.hpp"
 #include "math/Val.hpp"
 #include "math/Vec.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <memory>
+#include <span>
+#include <string_view>
 #include <vector>
 //---------------------------------------------------------------------------
 namespace physman::math {
@@ -11,9 +16,23 @@ namespace physman::math {
 struct ConstraintParam {};
 //---------------------------------------------------------------------------
 class Constraint {
+    /// Evaluate C, C' and J of an expression bundle at once, with TimeGradient also dC' / dx
+    template <unsigned Components, bool TimeGradient = false, typename S>
+    static auto evaluateDual(const auto& bundle, const S& state) {
+        using Scope = DualScope<S, Components, TimeGradient>;
+        std::array<typename Scope::D, 1> result;
+        bundle.eval(Scope{state}, result);
+        return result[0];
+    }
+
+    protected:
+    std::string_view name;
+
     public:
     /// Destructor
     virtual ~Constraint() = default;
+    /// Name shown in statistics
+    std::string_view getName() const { return name; }
     /// Get the number of components
     virtual unsigned numComponents() const = 0;
     /// Get the number of parameters
@@ -27,6 +46,8 @@ class Constraint {
     virtual Vec computeJacobian(const ValScope& state) const = 0;
     /// Jacobian of the time derivative. dC' / dx
     virtual Vec computeJacobian_dt(const ValScope& state) const = 0;
+    /// Evaluate all instances of a batch at once. Writes C and C' of each instance and numComponents() Jacobian entries per instance
+    virtual void computeBatch(const BatchScope& batch, std::span<num> C, std::span<num> C_dt, std::span<num> J) const = 0;
 
     /// The distance between two Vec3s must be "distance"
     static const Constraint* getDistance1();
@@ -54,57 +75,61 @@ class Constraint {
         })(std::make_index_sequence<Vecs>{}, std::make_index_sequence<Params>{});
     }
 
-    static auto makeConstraint(std::derived_from<val::Val> auto c) {
+    static auto makeConstraint(std::string_view name, std::derived_from<val::Val> auto c) {
         using T = decltype(c);
         static constexpr unsigned Components = val::Val::numComponents<T>();
         static constexpr unsigned Params = val::Val::numParams<T>();
-        auto c_dt = c.deriveBy(val::Time{});
-        auto [J, J_dt] = ([&]<size_t... Is>(std::index_sequence<Is...>) {
-            return std::make_pair(
-                std::make_tuple(c.deriveBy(val::Pos<Is>{})...),
-                std::make_tuple(c_dt.deriveBy(val::Pos<Is>{})...)
-                );
-        })(std::make_index_sequence<Components>{});
-
-        using c_type = decltype(c);
-        using c_dt_type = decltype(c_dt);
-        using J_type = decltype(J);
-        using J_dt_type = decltype(J_dt);
+        // C' and J come from a single evaluation with dual numbers instead of separate derivative trees
+        using bundle_type = decltype(val::Bundle{c});
 
         class MyConstraint final : public Constraint {
-            [[no_unique_address]] c_type c;
-            [[no_unique_address]] c_dt_type c_dt;
-            [[no_unique_address]] J_type J;
-            [[no_unique_address]] J_dt_type J_dt;
+            [[no_unique_address]] T c;
+            bundle_type bundle;
 
             public:
-            constexpr MyConstraint(decltype(c) c, decltype(c_dt) c_dt, decltype(J) J, decltype(J_dt) J_dt)
-                : c(c), c_dt(c_dt), J(J), J_dt(J_dt) {}
+            constexpr MyConstraint(std::string_view name, T c) : c(c), bundle(c) { this->name = name; }
 
             unsigned numComponents() const final { return Components; };
             unsigned numParameters() const final { return Params; };
             num computeC(const ValScope& state) const final { return c.evaluate(state); }
-            num computeC_dt(const ValScope& state) const final { return c_dt.evaluate(state); }
+            num computeC_dt(const ValScope& state) const final { return evaluateDual<Components>(bundle, state).dt; }
             Vec computeJacobian(const ValScope& state) const final {
-                Vec result(Components);
-                ([&]<size_t... Is>(std::index_sequence<Is...>) {
-                    ((result[Is] = std::get<Is>(J).evaluate(state)), ...);
-                })(std::make_index_sequence<Components>{});
-                return result;
+                auto grad = evaluateDual<Components>(bundle, state).grad;
+                return Vec(grad.begin(), grad.end());
             }
             Vec computeJacobian_dt(const ValScope& state) const final {
-                Vec result(Components);
-                ([&]<size_t... Is>(std::index_sequence<Is...>) {
-                    ((result[Is] = std::get<Is>(J).evaluate(state)), ...);
-                })(std::make_index_sequence<Components>{});
-                return result;
+                auto gradDt = evaluateDual<Components, true>(bundle, state).gradDt;
+                return Vec(gradDt.begin(), gradDt.end());
+            }
+            void computeBatch(const BatchScope& batch, std::span<num> C, std::span<num> C_dt, std::span<num> J) const final {
+                assert(C.size() >= batch.count && C_dt.size() >= batch.count);
+                assert(J.size() >= batch.count * Components);
+                size_t i = 0;
+                for (; i + packWidth <= batch.count; i += packWidth) {
+                    auto d = evaluateDual<Components>(bundle, batch.lanes<packWidth>(i));
+                    for (unsigned l = 0; l < packWidth; l++) {
+                        C[i + l] = d.v[l];
+                        C_dt[i + l] = d.dt[l];
+                        for (unsigned k = 0; k < Components; k++)
+                            J[(i + l) * Components + k] = d.grad[k][l];
+                    }
+                }
+                // Remaining instances one at a time
+                for (; i < batch.count; i++) {
+                    auto d = evaluateDual<Components>(bundle, batch[i]);
+                    C[i] = d.v;
+                    C_dt[i] = d.dt;
+                    std::copy_n(d.grad.begin(), Components, J.begin() + i * Components);
+                }
             }
         };
-        return MyConstraint(c, c_dt, J, J_dt);
+        return MyConstraint(name, c);
     }
 
     /// Extract specific components from larger valscope
-    static ValScope map(const ValScope& source, std::span<const unsigned> components, unsigned paramStart, unsigned paramCount);
+    static ValScope map(const ValScope& source, std::span<const unsigned> components, std::span<const num> params);
+    /// Gather the components and parameters of many instances into structure of arrays layout for a BatchScope
+    static void gather(std::span<const num> sourceXs, std::span<const num> sourceVs, std::span<const unsigned> components, unsigned componentCount, std::span<const num> params, unsigned paramCount, Vec& xs, Vec& vs, Vec& ps);
 };
 //---------------------------------------------------------------------------
 }
@@ -0,0 +1,115 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "math/Num.hpp"
+#include "math/Pack.hpp"
+#include <array>
+#include <cmath>
+#include <concepts>
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Forward mode dual number. Carries a value together with its total time derivative and its gradient with respect to N positions.
+/// T is num, or a Pack to process several instances at once. With TimeGradient, it also carries the gradient of the time derivative
+template <unsigned N, typename T = num, bool TimeGradient = false>
+struct Dual {
+    /// Size of gradDt
+    static constexpr unsigned M = TimeGradient ? N : 0;
+
+    T v{};
+    /// d/dt
+    T dt{};
+    /// d/dx_i
+    std::array<T, N> grad{};
+    /// d/dx_i of dt at fixed velocities, only with TimeGradient
+    std::array<T, M> gradDt{};
+
+    constexpr Dual() = default;
+    constexpr Dual(T v, T dt = T{0}) : v(v), dt(dt) {}
+    constexpr Dual(num v) requires(!std::same_as<T, num>) : v(v), dt(0) {}
+
+    /// Apply a function with the given value, first and second derivative at v
+    constexpr Dual chain(T value, T derivative, T second = T{0}) const {
+        Dual result{value, derivative * dt};
+        for (unsigned i = 0; i < N; i++)
+        result.grad[i] = derivative * grad[i];
+        for (unsigned i = 0; i < M; i++)
+            result.gradDt[i] = derivative * gradDt[i] + second * grad[i] * dt;
+        return result;
+    }
+};
+//---------------------------------------------------------------------------
+template <unsigned N, typename T, bool G>
+constexpr const T& value(const Dual<N, T, G>& a) { return a.v; }
+constexpr num value(num a) { return a; }
+//---------------------------------------------------------------------------
+template <unsigned N, typename T, bool G>
+constexpr Dual<N, T, G> operator-(const Dual<N, T, G>& a) { return a.chain(-a.v, T{-1}); }
+template <unsigned N, typename T, bool G>
+constexpr Dual<N, T, G> operator+(const Dual<N, T, G>& a, const Dual<N, T, G>& b) {
+    Dual<N, T, G> result{a.v + b.v, a.dt + b.dt};
+    for (unsigned i = 0; i < N; i++)
+        result.grad[i] = a.grad[i] + b.grad[i];
+    for (unsigned i = 0; i < Dual<N, T, G>::M; i++)
+        result.gradDt[i] = a.gradDt[i] + b.gradDt[i];
+    return result;
+}
+template <unsigned N, typename T, bool G>
+constexpr Dual<N, T, G> operator-(const Dual<N, T, G>& a, const Dual<N, T, G>& b) {
+    Dual<N, T, G> result{a.v - b.v, a.dt - b.dt};
+    for (unsigned i = 0; i < N; i++)
+        result.grad[i] = a.grad[i] - b.grad[i];
+    for (unsigned i = 0; i < Dual<N, T, G>::M; i++)
+        result.gradDt[i] = a.gradDt[i] - b.gradDt[i];
+    return result;
+}
+template <unsigned N, typename T, bool G>
+constexpr Dual<N, T, G> operator*(const Dual<N, T, G>& a, const Dual<N, T, G>& b) {
+    Dual<N, T, G> result{a.v * b.v, a.dt * b.v + a.v * b.dt};
+    for (unsigned i = 0; i < N; i++)
+        result.grad[i] = a.grad[i] * b.v + a.v * b.grad[i];
+    for (unsigned i = 0; i < Dual<N, T, G>::M; i++)
+        result.gradDt[i] = a.gradDt[i] * b.v + a.dt * b.grad[i] + a.grad[i] * b.dt + a.v * b.gradDt[i];
+    return result;
+}
+template <unsigned N, typename T, bool G>
+constexpr Dual<N, T, G> operator/(const Dual<N, T, G>& a, const Dual<N, T, G>& b) {
+    T inv = 1 / b.v;
+    T v = a.v * inv;
+    Dual<N, T, G> result{v, (a.dt - v * b.dt) * inv};
+    for (unsigned i = 0; i < N; i++)
+        result.grad[i] = (a.grad[i] - v * b.grad[i]) * inv;
+    // From b * result.dt = a.dt - v * b.dt
+    for (unsigned i = 0; i < Dual<N, T, G>::M; i++)
+        result.gradDt[i] = (a.gradDt[i] - result.grad[i] * b.dt - v * b.gradDt[i] - result.dt * b.grad[i]) * inv;
+    return result;
+}
+template <unsigned N, typename T, bool G> constexpr Dual<N, T, G> operator+(const Dual<N, T, G>& a, num b) { return a.chain(a.v + b, T{1}); }
+template <unsigned N, typename T, bool G> constexpr Dual<N, T, G> operator-(const Dual<N, T, G>& a, num b) { return a.chain(a.v - b, T{1}); }
+template <unsigned N, typename T, bool G> constexpr Dual<N, T, G> operator*(const Dual<N, T, G>& a, num b) { return a.chain(a.v * b, T{b}); }
+template <unsigned N, typename T, bool G> constexpr Dual<N, T, G> operator/(const Dual<N, T, G>& a, num b) { return a.chain(a.v / b, T{1 / b}); }
+template <unsigned N, typename T, bool G> constexpr Dual<N, T, G> operator+(num a, const Dual<N, T, G>& b) { return b.chain(a + b.v, T{1}); }
+template <unsigned N, typename T, bool G> constexpr Dual<N, T, G> operator-(num a, const Dual<N, T, G>& b) { return b.chain(a - b.v, T{-1}); }
+template <unsigned N, typename T, bool G> constexpr Dual<N, T, G> operator*(num a, const Dual<N, T, G>& b) { return b.chain(a * b.v, T{a}); }
+template <unsigned N, typename T, bool G>
+constexpr Dual<N, T, G> operator/(num a, const Dual<N, T, G>& b) {
+    if constexpr (G)
+        return b.chain(a / b.v, -a / (b.v * b.v), 2 * a / (b.v * b.v * b.v));
+    else
+        return b.chain(a / b.v, -a / (b.v * b.v));
+}
+template <unsigned N, typename T, bool G> Dual<N, T, G> sin(const Dual<N, T, G>& a) { using std::sin, std::cos; T s = sin(a.v); return a.chain(s, cos(a.v), -s); }
+template <unsigned N, typename T, bool G> Dual<N, T, G> cos(const Dual<N, T, G>& a) { using std::sin, std::cos; T c = cos(a.v); return a.chain(c, -sin(a.v), -c); }
+//---------------------------------------------------------------------------
+/// Per lane choice between a and b
+template <unsigned N, unsigned W, bool G>
+constexpr Dual<N, Pack<W>, G> select(const Mask<W>& m, const Dual<N, Pack<W>, G>& a, const Dual<N, Pack<W>, G>& b) {
+    Dual<N, Pack<W>, G> result{select(m, a.v, b.v), select(m, a.dt, b.dt)};
+    for (unsigned i = 0; i < N; i++)
+        result.grad[i] = select(m, a.grad[i], b.grad[i]);
+    for (unsigned i = 0; i < Dual<N, Pack<W>, G>::M; i++)
+        result.gradDt[i] = select(m, a.gradDt[i], b.gradDt[i]);
+    return result;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
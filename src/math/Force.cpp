@@ -1,38 +1,57 @@
 #include "math/Force.hpp"
 #include "math/Val.hpp"
 #include <cassert>
+#include <cmath>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
 //---------------------------------------------------------------------------
 using namespace std;
 //---------------------------------------------------------------------------
 namespace physman::math {
 //---------------------------------------------------------------------------
 const Force* Force::getConstant() {
-    static auto myForce = makeForce(integral_constant<unsigned, 3>{}, [](const ValScope& state, num x, num y, num z) {
-        return Vec{x, y, z};
+    static auto myForce = makeForce("constant", integral_constant<unsigned, 3>{}, []([[maybe_unused]] const IndexedScope& state, std::span<num> q, num x, num y, num z) {
+        q[0] = x;
+        q[1] = y;
+        q[2] = z;
     });
     return &myForce;
 }
 //---------------------------------------------------------------------------
 const Force* Force::getSpring3() {
-    static auto myForce = makeForce(integral_constant<unsigned, 3>{}, [](const ValScope& state, num ks, num kd, num r) -> Vec {
-        assert(state.xs.size() == 6);
+    static auto myForce = makeForce("spring3", integral_constant<unsigned, 3>{}, [](const IndexedScope& state, std::span<num> q, num ks, num kd, num r) {
+        assert(state.components.size() == 6);
 
-        auto x0 = state.xs.slice(0, 3);
-        auto x1 = state.xs.slice(3, 3);
-        auto v0 = state.vs.slice(0, 3);
-        auto v1 = state.vs.slice(3, 3);
+        num dx[3], dv[3];
+        for (unsigned i = 0; i < 3; i++) {
+            dx[i] = state.getPos(i) - state.getPos(i + 3);
+            dv[i] = state.getVel(i) - state.getVel(i + 3);
+        }
+        auto dist = std::sqrt(dx[0] * dx[0] + dx[1] * dx[1] + dx[2] * dx[2]);
+        num dxnorm[3] = {dx[0] / dist, dx[1] / dist, dx[2] / dist};
 
-        auto dx = x0 - x1;
-        auto dv = v0 - v1;
-        auto dist = sqrt(dx * dx);
-        auto dxnorm = dx / dist;
-
-        auto f = -(ks * (dist - r) + (kd * dxnorm) * dv) * dxnorm;
-
-        return Vec::concat(f, -f);
+        auto scale = -(ks * (dist - r) + kd * (dxnorm[0] * dv[0] + dxnorm[1] * dv[1] + dxnorm[2] * dv[2]));
+        for (unsigned i = 0; i < 3; i++) {
+            q[i] = scale * dxnorm[i];
+            q[i + 3] = -scale * dxnorm[i];
+        }
     });
     return &myForce;
 }
 //---------------------------------------------------------------------------
+TEST_CASE("math/Force") {
+    using Catch::Approx;
+    // Stretched spring along x, separating along x
+    num xs[] = {2, 0, 0, 0, 0, 0};
+    num vs[] = {1, 0, 0, 0, 0, 0};
+    unsigned components[] = {0, 1, 2, 3, 4, 5};
+    num params[] = {10, 2, 1};
+    num q[6];
+    Force::getSpring3()->computeQ({xs, vs, components, params, 0}, q);
+    REQUIRE(q[0] == Approx(-(10 * (2 - 1) + 2 * 1)));
+    REQUIRE(q[1] == Approx(0.0));
+    REQUIRE(q[3] == Approx(10 * (2 - 1) + 2 * 1));
+}
+//---------------------------------------------------------------------------
 }
 //---------------------------------------------------------------------------
\ No newline at end of file
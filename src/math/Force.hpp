@@ -4,17 +4,24 @@
 #include "math/Vec.hpp"
 #include <functional>
 #include <memory>
+#include <span>
+#include <string_view>
 //---------------------------------------------------------------------------
 namespace physman::math {
 //---------------------------------------------------------------------------
-struct ValScope;
+struct IndexedScope;
 //---------------------------------------------------------------------------
 class Force {
+    protected:
+    std::string_view name;
+
     public:
     /// Destructor
     virtual ~Force() = default;
-    /// Get the result of the force function (how much force is applied per component)
-    virtual Vec computeQ(const ValScope& state) const = 0;
+    /// Name shown in statistics
+    std::string_view getName() const { return name; }
+    /// Get the result of the force function (how much force is applied per component), one entry of q per component
+    virtual void computeQ(const IndexedScope& state, std::span<num> q) const = 0;
     /// Get the number of parameters
     virtual unsigned numParameters() const = 0;
 
@@ -24,20 +31,20 @@ class Force {
     static const Force* getSpring3();
 
     template <unsigned NumParameters, typename Func>
-    static auto makeForce(std::integral_constant<unsigned, NumParameters>, Func&& func) {
+    static auto makeForce(std::string_view name, std::integral_constant<unsigned, NumParameters>, Func&& func) {
         using FF = std::decay_t<Func>;
         class MyForce : public Force, FF {
             public:
-            constexpr MyForce(FF&& f) : Func(std::move(f)) {}
-            constexpr MyForce(const FF& f) : Func(f) {}
+            constexpr MyForce(std::string_view name, FF&& f) : Func(std::move(f)) { this->name = name; }
+            constexpr MyForce(std::string_view name, const FF& f) : Func(f) { this->name = name; }
             unsigned numParameters() const final { return NumParameters; };
-            Vec computeQ(const ValScope& state) const final {
-                return [&]<size_t... Is>(std::index_sequence<Is...>) {
-                    return Func::operator()(state, state.getParam(Is)...);
+            void computeQ(const IndexedScope& state, std::span<num> q) const final {
+                [&]<size_t... Is>(std::index_sequence<Is...>) {
+                    this->Func::operator()(state, q, state.getParam(Is)...);
                 }(std::make_index_sequence<NumParameters>{});
             }
         };
-        return MyForce(std::forward<Func>(func));
+        return MyForce(name, std::forward<Func>(func));
     }
 };
 //---------------------------------------------------------------------------
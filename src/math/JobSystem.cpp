@@ -0,0 +1,179 @@
+#include "math/JobSystem.hpp"
+#include "math/Trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <cassert>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+JobSystem::JobSystem(unsigned threads) {
+    start(threads);
+}
+//---------------------------------------------------------------------------
+JobSystem::~JobSystem() noexcept {
+    stop();
+}
+//---------------------------------------------------------------------------
+void JobSystem::start(unsigned threads)
+// Spawn threads - 1 workers, the caller is the last thread
+{
+    if (!threads)
+        threads = max(thread::hardware_concurrency(), 1u);
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    // Built without thread support
+    threads = 1;
+#endif
+    ranges = make_unique<Range[]>(threads);
+    stopping = false;
+    workers.reserve(threads - 1);
+    for (unsigned i = 0; i + 1 < threads; i++)
+        workers.emplace_back([this, i, seen = generation] { workerLoop(i, seen); });
+}
+//---------------------------------------------------------------------------
+void JobSystem::stop() {
+    {
+        lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+    workers.clear();
+}
+//---------------------------------------------------------------------------
+void JobSystem::setThreadCount(unsigned threads) {
+    assert(!body);
+    stop();
+    start(threads);
+}
+//---------------------------------------------------------------------------
+void JobSystem::workerLoop(unsigned index, size_t seen)
+// Run every loop started after generation seen
+{
+    Trace::nameThread("job worker " + to_string(index));
+    while (true) {
+        {
+            unique_lock lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        runChunks(index);
+        {
+            lock_guard lock(mutex);
+            if (!--busy)
+                done.notify_one();
+        }
+    }
+}
+//---------------------------------------------------------------------------
+bool JobSystem::takeChunk(unsigned index, size_t& chunk)
+// Take the next chunk of the own range, or steal the back half of another range
+{
+    auto& own = ranges[index];
+    {
+        lock_guard lock(own.mutex);
+        if (own.next < own.end) {
+            chunk = own.next++;
+            return true;
+        }
+    }
+    auto threads = getThreadCount();
+    for (unsigned k = 1; k < threads; k++) {
+        auto& victim = ranges[(index + k) % threads];
+        size_t first, last;
+        {
+            lock_guard lock(victim.mutex);
+            auto left = victim.end - victim.next;
+            if (!left)
+                continue;
+            last = victim.end;
+            first = victim.end - (left + 1) / 2;
+            victim.end = first;
+        }
+        {
+            lock_guard lock(own.mutex);
+            own.next = first + 1;
+            own.end = last;
+        }
+        chunk = first;
+        return true;
+    }
+    return false;
+}
+//---------------------------------------------------------------------------
+void JobSystem::runChunks(unsigned index) {
+    TraceScope trace("jobs");
+    size_t chunk;
+    while (takeChunk(index, chunk)) {
+        auto begin = chunk * grain;
+        (*body)(begin, min(count, begin + grain));
+    }
+}
+//---------------------------------------------------------------------------
+void JobSystem::parallelFor(size_t count, size_t grain, Body body)
+// Split the chunks evenly over the threads, then run them with stealing
+{
+    assert(grain > 0);
+    assert(!this->body && "nested parallelFor");
+    auto chunks = numChunks(count, grain);
+    if (workers.empty() || chunks <= 1) {
+        for (size_t begin = 0; begin < count; begin += grain)
+            body(begin, min(count, begin + grain));
+        return;
+    }
+    auto threads = getThreadCount();
+    for (unsigned i = 0; i < threads; i++) {
+        lock_guard lock(ranges[i].mutex);
+        ranges[i].next = chunks * i / threads;
+        ranges[i].end = chunks * (i + 1) / threads;
+    }
+    {
+        lock_guard lock(mutex);
+        this->body = &body;
+        this->count = count;
+        this->grain = grain;
+        busy = static_cast<unsigned>(workers.size());
+        generation++;
+    }
+    wake.notify_all();
+    runChunks(threads - 1);
+    unique_lock lock(mutex);
+    done.wait(lock, [&] { return !busy; });
+    this->body = nullptr;
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/JobSystem") {
+    // Every item is visited once and chunk boundaries do not depend on the thread count
+    for (unsigned threads : {1u, 2u, 4u, 7u}) {
+        JobSystem jobs(threads);
+        REQUIRE(jobs.getThreadCount() == threads);
+        for (size_t count : {0u, 1u, 5u, 64u, 1000u}) {
+            vector<atomic<unsigned>> visits(count);
+            vector<size_t> chunkEnds(JobSystem::numChunks(count, 8));
+            jobs.parallelFor(count, 8, [&](size_t begin, size_t end) {
+                chunkEnds[begin / 8] = end;
+                for (size_t i = begin; i < end; i++)
+                    visits[i]++;
+                // Uneven work so that threads steal
+                if (begin % 24 == 0)
+                    this_thread::yield();
+            });
+            for (auto& v : visits)
+                REQUIRE(v == 1);
+            for (size_t c = 0; c < chunkEnds.size(); c++)
+                REQUIRE(chunkEnds[c] == min(count, (c + 1) * 8));
+        }
+    }
+    JobSystem jobs;
+    jobs.setThreadCount(3);
+    REQUIRE(jobs.getThreadCount() == 3);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
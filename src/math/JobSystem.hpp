@@ -0,0 +1,70 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <tl/function_ref.hpp>
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Work stealing thread pool for data parallel loops. The calling thread takes part in every loop.
+/// Each thread owns a range of chunks and works on it from the front, idle threads steal the back half of another thread's range.
+/// Chunk boundaries only depend on the item count and the grain, so a loop that writes per chunk results gives the same output at any thread count
+class JobSystem {
+    public:
+    /// Called with the items [begin, end) of one chunk
+    using Body = tl::function_ref<void(size_t begin, size_t end)>;
+
+    private:
+    /// Chunks [next, end) not yet taken from a thread's range
+    struct Range {
+        std::mutex mutex;
+        size_t next = 0;
+        size_t end = 0;
+    };
+    std::vector<std::thread> workers;
+    /// One range per thread, the caller uses the last one
+    std::unique_ptr<Range[]> ranges;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    /// The running loop
+    const Body* body = nullptr;
+    size_t count = 0;
+    size_t grain = 1;
+    /// Incremented for every loop that uses the workers
+    size_t generation = 0;
+    /// Workers still inside the current loop
+    unsigned busy = 0;
+    bool stopping = false;
+
+    void start(unsigned threads);
+    void stop();
+    void workerLoop(unsigned index, size_t seen);
+    /// Run chunks until no thread has any left
+    void runChunks(unsigned index);
+    bool takeChunk(unsigned index, size_t& chunk);
+
+    public:
+    /// Use the given number of threads, including the caller
+    explicit JobSystem(unsigned threads = 1);
+    ~JobSystem() noexcept;
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    /// Number of threads, including the caller
+    unsigned getThreadCount() const { return static_cast<unsigned>(workers.size()) + 1; }
+    /// Change the number of threads, 0 uses all hardware threads. Must not be called during a loop
+    void setThreadCount(unsigned threads);
+    /// Number of chunks parallelFor splits count items into
+    static size_t numChunks(size_t count, size_t grain) { return (count + grain - 1) / grain; }
+    /// Call body for chunks of up to grain items covering [0, count) and wait for all of them. Does not allocate
+    void parallelFor(size_t count, size_t grain, Body body);
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -4,8 +4,15 @@
 //---------------------------------------------------------------------------
 namespace physman {
 //---------------------------------------------------------------------------
+/// Scalar type of the simulation. PHYSMAN_FLOAT halves the memory traffic and doubles the SIMD width at the cost of accuracy
+#ifdef PHYSMAN_FLOAT
+using num = float;
+#else
 using num = double;
+#endif
+/// Storage type of the matrix values in the mixed precision solver, see Algorithm::solveRefined
+using lownum = float;
 static constexpr num epsilon = 1e-5;
 //---------------------------------------------------------------------------
 }
-//---------------------------------------------------------------------------
\ No newline at end of file
+//---------------------------------------------------------------------------
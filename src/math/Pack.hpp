@@ -0,0 +1,86 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "math/Num.hpp"
+#include <array>
+#include <cmath>
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Number of lanes used for batch evaluation, enough to fill an AVX register
+static constexpr unsigned packWidth = 32 / sizeof(num);
+//---------------------------------------------------------------------------
+/// W values that are processed together. All operations are fixed length loops over the lanes, which the compiler maps to SIMD instructions
+template <unsigned W>
+struct Pack {
+    std::array<num, W> lanes;
+
+    Pack() = default;
+    /// Broadcast
+    constexpr Pack(num s) { lanes.fill(s); }
+
+    static constexpr Pack load(const num* p) {
+        Pack result;
+        for (unsigned i = 0; i < W; i++)
+            result.lanes[i] = p[i];
+        return result;
+    }
+    constexpr num operator[](unsigned i) const { return lanes[i]; }
+    constexpr num& operator[](unsigned i) { return lanes[i]; }
+};
+/// Per lane condition
+template <unsigned W>
+struct Mask {
+    std::array<bool, W> lanes;
+    constexpr bool operator[](unsigned i) const { return lanes[i]; }
+    constexpr bool& operator[](unsigned i) { return lanes[i]; }
+};
+//---------------------------------------------------------------------------
+template <unsigned W>
+constexpr Pack<W> map(const Pack<W>& a, auto&& op) {
+    Pack<W> result;
+    for (unsigned i = 0; i < W; i++)
+        result[i] = op(a[i]);
+    return result;
+}
+template <unsigned W>
+constexpr Pack<W> map(const Pack<W>& a, const Pack<W>& b, auto&& op) {
+    Pack<W> result;
+    for (unsigned i = 0; i < W; i++)
+        result[i] = op(a[i], b[i]);
+    return result;
+}
+//---------------------------------------------------------------------------
+template <unsigned W> constexpr Pack<W> operator-(const Pack<W>& a) { return map(a, [](num x) { return -x; }); }
+#define PHYSMAN_PACK_DEFOP(op) \
+template <unsigned W> constexpr Pack<W> operator op(const Pack<W>& a, const Pack<W>& b) { return map(a, b, [](num x, num y) { return x op y; }); } \
+template <unsigned W> constexpr Pack<W> operator op(const Pack<W>& a, num b) { return map(a, [b](num x) { return x op b; }); } \
+template <unsigned W> constexpr Pack<W> operator op(num a, const Pack<W>& b) { return map(b, [a](num y) { return a op y; }); }
+PHYSMAN_PACK_DEFOP(+)
+PHYSMAN_PACK_DEFOP(-)
+PHYSMAN_PACK_DEFOP(*)
+PHYSMAN_PACK_DEFOP(/)
+#undef PHYSMAN_PACK_DEFOP
+template <unsigned W> Pack<W> sin(const Pack<W>& a) { return map(a, [](num x) { return std::sin(x); }); }
+template <unsigned W> Pack<W> cos(const Pack<W>& a) { return map(a, [](num x) { return std::cos(x); }); }
+//---------------------------------------------------------------------------
+template <unsigned W>
+constexpr const Pack<W>& value(const Pack<W>& a) { return a; }
+/// Evaluate a scalar condition on every lane
+template <unsigned W>
+constexpr Mask<W> makeMask(const Pack<W>& a, auto&& cond) {
+    Mask<W> result;
+    for (unsigned i = 0; i < W; i++)
+        result[i] = cond(a[i]);
+    return result;
+}
+/// Per lane choice between a and b
+template <unsigned W>
+constexpr Pack<W> select(const Mask<W>& m, const Pack<W>& a, const Pack<W>& b) {
+    Pack<W> result;
+    for (unsigned i = 0; i < W; i++)
+        result[i] = m[i] ? a[i] : b[i];
+    return result;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
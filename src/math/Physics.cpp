@@ -1,124 +1,1055 @@
 #include "math/Physics.hpp"
-#include "math/Algorithm.hpp"
+#include "math/Allocation.hpp"
+#include "math/Stats.hpp"
+#include "math/Trace.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <type_traits>
 #include <unordered_map>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
 #include <fmt/format.h>
 //---------------------------------------------------------------------------
 using namespace std;
 //---------------------------------------------------------------------------
 namespace physman::math {
 //---------------------------------------------------------------------------
+/// Instances per job system chunk. Fixed, so that the results do not depend on the thread count
+static constexpr size_t forceGrain = 64;
+/// A multiple of packWidth, so that only the last chunk of a group has a scalar remainder
+static constexpr size_t constraintGrain = 16 * packWidth;
+/// Islands with at least this many constraints are solved one at a time using all threads, smaller islands are spread over the threads
+static constexpr size_t largeIslandRows = 1024;
+//---------------------------------------------------------------------------
+/// Mass of released components, they do not react to any force
+static constexpr num releasedMass = numeric_limits<num>::infinity();
+//---------------------------------------------------------------------------
+static unsigned findRoot(vector<unsigned>& parents, unsigned i)
+// Union-find lookup with path halving
+{
+    while (parents[i] != i)
+        i = parents[i] = parents[parents[i]];
+    return i;
+}
+//---------------------------------------------------------------------------
+static void unite(vector<unsigned>& parents, unsigned a, unsigned b)
+// Merge two union-find sets, the smaller index becomes the root
+{
+    a = findRoot(parents, a);
+    b = findRoot(parents, b);
+    if (a != b)
+        parents[max(a, b)] = min(a, b);
+}
+//---------------------------------------------------------------------------
+template <typename T>
+unsigned Physics::InstanceSet<T>::add(const T* type, std::span<const unsigned> cs, std::span<const num> ps)
+// Add an instance, returns its handle
+{
+    auto it = find_if(groups.begin(), groups.end(), [&](const Group<T>& g) { return g.type == type; });
+    if (it == groups.end()) {
+        Group<T> group;
+        group.type = type;
+        group.componentCount = static_cast<unsigned>(cs.size());
+        group.paramCount = static_cast<unsigned>(ps.size());
+        groups.push_back(move(group));
+        it = groups.end() - 1;
+    }
+    auto& group = *it;
+    assert(group.componentCount == cs.size());
+    assert(group.paramCount == ps.size());
+
+    unsigned handle;
+    if (!freeSlots.empty()) {
+        handle = freeSlots.back();
+        freeSlots.pop_back();
+    } else {
+        handle = static_cast<unsigned>(slots.size());
+        slots.emplace_back();
+    }
+    slots[handle] = {static_cast<unsigned>(it - groups.begin()), static_cast<unsigned>(group.size())};
+    group.components.insert(group.components.end(), cs.begin(), cs.end());
+    group.params.insert(group.params.end(), ps.begin(), ps.end());
+    group.handles.push_back(handle);
+    count++;
+    return handle;
+}
+//---------------------------------------------------------------------------
+template <typename T>
+void Physics::InstanceSet<T>::remove(unsigned handle)
+// Remove an instance by swapping the last instance of its group into its place
+{
+    auto [groupIndex, index] = slots[handle];
+    auto& group = groups[groupIndex];
+    assert(index < group.size() && group.handles[index] == handle);
+    auto last = group.size() - 1;
+    if (index != last) {
+        copy_n(group.components.begin() + last * group.componentCount, group.componentCount, group.components.begin() + index * group.componentCount);
+        copy_n(group.params.begin() + last * group.paramCount, group.paramCount, group.params.begin() + index * group.paramCount);
+        group.handles[index] = group.handles[last];
+        slots[group.handles[index]].second = index;
+    }
+    group.components.resize(last * group.componentCount);
+    group.params.resize(last * group.paramCount);
+    group.handles.pop_back();
+    freeSlots.push_back(handle);
+    count--;
+}
+//---------------------------------------------------------------------------
+template <typename T>
+template <typename Pred>
+void Physics::InstanceSet<T>::removeIf(Pred pred)
+// Move the remaining instances of each group to its front
+{
+    for (unsigned g = 0; g < groups.size(); g++) {
+        auto& group = groups[g];
+        unsigned kept = 0;
+        for (unsigned i = 0; i < group.size(); i++) {
+            if (pred(group.getComponents(i))) {
+                freeSlots.push_back(group.handles[i]);
+                count--;
+                continue;
+            }
+            if (kept != i) {
+                copy_n(group.components.begin() + i * group.componentCount, group.componentCount, group.components.begin() + kept * group.componentCount);
+                copy_n(group.params.begin() + i * group.paramCount, group.paramCount, group.params.begin() + kept * group.paramCount);
+                group.handles[kept] = group.handles[i];
+            }
+            slots[group.handles[kept]] = {g, kept};
+            kept++;
+        }
+        group.components.resize(kept * group.componentCount);
+        group.params.resize(kept * group.paramCount);
+        group.handles.resize(kept);
+    }
+}
+//---------------------------------------------------------------------------
+template <typename T>
+void Physics::InstanceSet<T>::clear()
+// Remove all instances, keeps the allocated memory
+{
+    for (auto& group : groups) {
+        group.components.clear();
+        group.params.clear();
+        group.handles.clear();
+    }
+    slots.clear();
+    freeSlots.clear();
+    count = 0;
+}
+//---------------------------------------------------------------------------
+Physics::Physics() = default;
+//---------------------------------------------------------------------------
 Physics::Physics(const Vec& xs, const Vec& vs, Vec ms, num t) : state(Vec::concat(xs, vs)), ms(move(ms)), t(t) {
     assert(xs.size() == vs.size());
+    assert(xs.size() == this->ms.size());
+    numComps = static_cast<unsigned>(xs.size());
+    idleTimes.assign(numComps, 0);
 }
 Physics::~Physics() noexcept = default;
 //---------------------------------------------------------------------------
-void Physics::addConstraint(const Constraint* constraint, std::span<const unsigned> cs, std::span<const num> ps) {
+void Physics::reserveComponents(unsigned newCapacity)
+// Grow the state, moving the velocities behind the new position half
+{
+    auto oldCapacity = capacity();
+    if (newCapacity <= oldCapacity)
+        return;
+    Vec newState(2 * newCapacity);
+    copy_n(state.begin(), oldCapacity, newState.begin());
+    copy_n(state.begin() + oldCapacity, oldCapacity, newState.begin() + newCapacity);
+    state = move(newState);
+    ms.resize(newCapacity, releasedMass);
+    idleTimes.resize(newCapacity, 0);
+}
+//---------------------------------------------------------------------------
+unsigned Physics::addComponents(std::span<const num> xs, std::span<const num> vs, std::span<const num> ms)
+// Add components, reusing released ones if possible
+{
+    assert(xs.size() == vs.size() && xs.size() == ms.size());
+    auto count = static_cast<unsigned>(xs.size());
+    unsigned offset;
+    auto it = find_if(freeComponents.begin(), freeComponents.end(), [&](auto& r) { return r.second == count; });
+    if (it != freeComponents.end()) {
+        offset = it->first;
+        *it = freeComponents.back();
+        freeComponents.pop_back();
+    } else {
+        if (numComps + count > capacity())
+            reserveComponents(max(numComps + count, 2 * capacity()));
+        offset = numComps;
+        numComps += count;
+    }
+    auto cap = capacity();
+    for (unsigned i = 0; i < count; i++) {
+        state[offset + i] = xs[i];
+        state[cap + offset + i] = vs[i];
+        this->ms[offset + i] = ms[i];
+        idleTimes[offset + i] = 0;
+    }
+    patternDirty = true;
+    return offset;
+}
+//---------------------------------------------------------------------------
+void Physics::removeComponents(unsigned offset, unsigned count)
+// Release components, they are kept at rest with infinite mass until reused
+{
+    assert(offset + count <= numComps);
+    auto cap = capacity();
+    for (unsigned i = offset; i < offset + count; i++) {
+        state[i] = 0;
+        state[cap + i] = 0;
+        ms[i] = releasedMass;
+        idleTimes[i] = 0;
+    }
+    freeComponents.emplace_back(offset, count);
+    patternDirty = true;
+}
+//---------------------------------------------------------------------------
+void Physics::setSleepOptions(const SleepOptions& options)
+// Which components sleep can change with any of the options
+{
+    if (options.enabled != sleepOptions.enabled)
+        fill(idleTimes.begin(), idleTimes.end(), 0);
+    sleepOptions = options;
+    patternDirty = true;
+}
+//---------------------------------------------------------------------------
+void Physics::wake(unsigned offset, unsigned count) {
+    assert(offset + count <= numComps);
+    for (unsigned i = offset; i < offset + count; i++) {
+        patternDirty |= isAsleep(i);
+        idleTimes[i] = 0;
+    }
+}
+//---------------------------------------------------------------------------
+void Physics::wake(std::span<const unsigned> components)
+// Restart the resting time, the rest of their group follows when the pattern is rebuilt
+{
+    for (auto c : components) {
+        patternDirty |= isAsleep(c);
+        idleTimes[c] = 0;
+    }
+}
+//---------------------------------------------------------------------------
+ConstraintId Physics::addConstraint(const Constraint* constraint, std::span<const unsigned> cs, std::span<const num> ps) {
     assert(constraint->numComponents() == cs.size());
     assert(constraint->numParameters() == ps.size());
-    auto& myConstraint = constraints[constraint];
-    myConstraint.push_back({static_cast<unsigned>(components.size()), static_cast<unsigned>(cs.size()), static_cast<unsigned>(params.size()), static_cast<unsigned>(ps.size())});
-    components.insert(components.end(), cs.begin(), cs.end());
-    params.insert(params.end(), ps.begin(), ps.end());
-    numConstraints++;
+    patternDirty = true;
+    wake(cs);
+    return ConstraintId{constraints.add(constraint, cs, ps)};
 }
 //---------------------------------------------------------------------------
-void Physics::addForce(const Force* force, std::span<const unsigned> cs, std::span<const num> ps) {
+void Physics::removeConstraint(ConstraintId id) {
+    patternDirty = true;
+    auto [group, index] = constraints.slots[static_cast<unsigned>(id)];
+    wake(constraints.groups[group].getComponents(index));
+    constraints.remove(static_cast<unsigned>(id));
+}
+//---------------------------------------------------------------------------
+void Physics::addContact(const Constraint* constraint, std::span<const unsigned> cs, std::span<const num> ps) {
+    assert(constraint->numComponents() == cs.size());
+    assert(constraint->numParameters() == ps.size());
+    contacts.add(constraint, cs, ps);
+}
+//---------------------------------------------------------------------------
+void Physics::clearContacts() {
+    contacts.clear();
+}
+//---------------------------------------------------------------------------
+void Physics::clearAwakeContacts() {
+    contacts.removeIf([&](span<const unsigned> cs) { return !ranges::all_of(cs, [&](unsigned c) { return isAsleep(c); }); });
+}
+//---------------------------------------------------------------------------
+bool Physics::contactsChanged() const
+// The contacts of a step usually repeat those of the last one, then the pattern and the islands can stay
+{
+    return ranges::any_of(contacts.groups, [](const Group<Constraint>& group) {
+        return !ranges::equal(group.components, group.patternComponents) || !ranges::equal(group.params, group.patternParams);
+    });
+}
+//---------------------------------------------------------------------------
+ForceId Physics::addForce(const Force* force, std::span<const unsigned> cs, std::span<const num> ps) {
     assert(force->numParameters() == ps.size());
-    auto& myForce = forces[force];
-    myForce.push_back({static_cast<unsigned>(components.size()), static_cast<unsigned>(cs.size()), static_cast<unsigned>(params.size()), static_cast<unsigned>(ps.size())});
-    components.insert(components.end(), cs.begin(), cs.end());
-    params.insert(params.end(), ps.begin(), ps.end());
-    numForces++;
-}
-//---------------------------------------------------------------------------
-struct SparseMatrix {
-    vector<unordered_map<unsigned, num>> rows;
-    vector<unordered_map<unsigned, num>> cols;
-
-    SparseMatrix(size_t rows, size_t cols) : rows(rows), cols(cols) {}
-
-    void add(unsigned row, unsigned col, num val) {
-        rows[row][col] += val;
-        cols[col][row] += val;
-    }
-
-    Vec dot(Vec v) {
-        Vec result(rows.size());
-        assert(v.size() == cols.size());
-        for (size_t i = 0; i < v.size(); i++)
-            for (auto [k, n] : cols[i])
-                result[k] += n * v[i];
-        return result;
-    }
-    Vec dotT(Vec v) {
-        Vec result(cols.size());
-        assert(v.size() == rows.size());
-        for (size_t i = 0; i < v.size(); i++)
-            for (auto [k, n] : rows[i])
-                result[k] += n * v[i];
-        return result;
-    }
-};
-//---------------------------------------------------------------------------
-void Physics::step(num h) {
-    state = Algorithm::ode(state, t, h, [&](const Vec& state, num t) -> Vec {
-        ValScope scope;
-        scope.xs = state.slice(0, state.size() / 2);
-        scope.vs = state.slice(state.size() / 2, state.size() / 2);
-        scope.ps = params;
-        scope.t = t;
-
-        Vec W = 1.0 / ms;
-
-        Vec Q(scope.xs.size());
-        for (auto& [f, mappings] : forces) {
-            for (auto& m : mappings) {
-                auto fcomponents = span{components}.subspan(m.componentOffset, m.componentCount);
-                auto mapped = Constraint::map(scope, fcomponents, m.paramOffset, m.paramCount);
-                auto forceVals = f->computeQ(mapped);
-                for (size_t i = 0; i < fcomponents.size(); i++)
-                    Q[fcomponents[i]] += forceVals[i];
+    patternDirty = true;
+    wake(cs);
+    return ForceId{forces.add(force, cs, ps)};
+}
+//---------------------------------------------------------------------------
+void Physics::removeForce(ForceId id) {
+    patternDirty = true;
+    auto [group, index] = forces.slots[static_cast<unsigned>(id)];
+    wake(forces.groups[group].getComponents(index));
+    forces.remove(static_cast<unsigned>(id));
+}
+//---------------------------------------------------------------------------
+void Physics::buildPattern()
+// Collect the awake instances and build the sparsity pattern of the Jacobians, one row per awake constraint
+{
+    buildSleepGroups();
+    auto collectActive = [&](auto& group) {
+        group.activeComponents.clear();
+        group.activeParams.clear();
+        group.activeCount = 0;
+        for (size_t i = 0; i < group.size(); i++) {
+            auto cs = group.getComponents(i);
+            // All components of an instance are in the same sleep group
+            if (!cs.empty() && isAsleep(cs[0]))
+                continue;
+            auto ps = group.getParams(i);
+            group.activeComponents.insert(group.activeComponents.end(), cs.begin(), cs.end());
+            group.activeParams.insert(group.activeParams.end(), ps.begin(), ps.end());
+            group.activeCount++;
+        }
+    };
+    for (auto& group : forces.groups)
+        collectActive(group);
+    J.resetPattern(capacity());
+    for (auto* set : {&constraints, &contacts}) {
+        for (auto& group : set->groups) {
+            collectActive(group);
+            if (group.activeCount)
+                J.addRows(group.activeComponents, group.componentCount);
+        }
+    }
+    for (auto& group : contacts.groups) {
+        group.patternComponents.assign(group.components.begin(), group.components.end());
+        group.patternParams.assign(group.params.begin(), group.params.end());
+    }
+    J.finishPattern();
+    buildIslands();
+    // Cached derivatives of the integrator belong to the old constraints
+    odeWorkspace.cachedT = numeric_limits<num>::quiet_NaN();
+    patternDirty = false;
+    if constexpr (statsEnabled) {
+        auto countTypes = [](auto& set, vector<PhysicsStats::TypeCount>& counts) {
+            counts.clear();
+            for (auto& group : set.groups)
+                if (group.activeCount)
+                    counts.push_back({group.type->getName(), group.activeCount});
+        };
+        countTypes(constraints, stats.constraints);
+        countTypes(contacts, stats.contacts);
+        countTypes(forces, stats.forces);
+        stats.nonzeros = J.nonZeros();
+    }
+}
+//---------------------------------------------------------------------------
+void Physics::buildSleepGroups()
+// Union-find over the components of all constraints, contacts and forces. A group sleeps only if all of its components do
+{
+    auto n = capacity();
+    parents.resize(n);
+    iota(parents.begin(), parents.end(), 0u);
+    auto uniteInstances = [&](auto& group) {
+        for (size_t i = 0; i < group.size(); i++) {
+            auto cs = group.getComponents(i);
+            for (size_t k = 1; k < cs.size(); k++)
+                unite(parents, cs[0], cs[k]);
+        }
+    };
+    for (auto* set : {&constraints, &contacts})
+        for (auto& group : set->groups)
+            uniteInstances(group);
+    for (auto& group : forces.groups)
+        uniteInstances(group);
+
+    // A group that is partially awake wakes completely, the others share the shortest resting time
+    auto groupIdle = arena.allocate<num>(n, numeric_limits<num>::infinity());
+    auto groupSize = arena.allocate<unsigned>(n, 0);
+    for (unsigned c = 0; c < numComps; c++) {
+        auto root = findRoot(parents, c);
+        groupIdle[root] = min(groupIdle[root], idleTimes[c]);
+    }
+    for (unsigned c = 0; c < numComps; c++) {
+        auto root = findRoot(parents, c);
+        idleTimes[c] = groupIdle[root];
+        if (!isAsleep(c))
+            groupSize[root]++;
+    }
+
+    // Members of the awake groups, grouped by root
+    sleepGroupStart.assign(1, 0);
+    for (unsigned root = 0; root < n; root++) {
+        if (groupSize[root]) {
+            auto start = sleepGroupStart.back();
+            sleepGroupStart.push_back(start + groupSize[root]);
+            groupSize[root] = start;
+        }
+    }
+    sleepMembers.resize(sleepGroupStart.back());
+    for (unsigned c = 0; c < numComps; c++)
+        if (!isAsleep(c))
+            sleepMembers[groupSize[findRoot(parents, c)]++] = c;
+}
+//---------------------------------------------------------------------------
+void Physics::updateSleep(num h)
+// Advance the resting time of the awake groups, groups that rested long enough fall asleep with zero velocity
+{
+    if (!sleepOptions.enabled)
+        return;
+    auto cap = capacity();
+    for (size_t g = 0; g + 1 < sleepGroupStart.size(); g++) {
+        auto members = span{sleepMembers}.subspan(sleepGroupStart[g], sleepGroupStart[g + 1] - sleepGroupStart[g]);
+        num energy = 0;
+        num idle = numeric_limits<num>::infinity();
+        for (auto c : members) {
+            auto v = state[cap + c];
+            if (isfinite(ms[c]))
+                energy += ms[c] * v * v / 2;
+            idle = min(idle, idleTimes[c]);
+        }
+        idle = energy <= sleepOptions.energy * members.size() ? idle + h : 0;
+        for (auto c : members)
+            idleTimes[c] = idle;
+        if (idle >= sleepOptions.delay) {
+            for (auto c : members)
+                state[cap + c] = 0;
+            patternDirty = true;
+        }
+    }
+}
+//---------------------------------------------------------------------------
+void Physics::buildIslands()
+// Union-find over the components of each constraint row, then one matrix per connected set of rows
+{
+    auto n = J.cols();
+    parents.resize(n);
+    iota(parents.begin(), parents.end(), 0u);
+    for (size_t r = 0; r < J.rows(); r++) {
+        auto cols = J.getRowCols(r);
+        for (size_t k = 1; k < cols.size(); k++)
+            unite(parents, cols[0], cols[k]);
+    }
+
+    // Islands are numbered by their first row. The island buffers are kept to avoid reallocations
+    constexpr auto none = numeric_limits<unsigned>::max();
+    auto islandOf = arena.allocate<unsigned>(n, none);
+    auto local = arena.allocate<unsigned>(n, none);
+    size_t count = 0;
+    size_t maxRowLength = 0;
+    for (size_t r = 0; r < J.rows(); r++) {
+        auto cols = J.getRowCols(r);
+        maxRowLength = max(maxRowLength, cols.size());
+        if (cols.empty())
+            continue;
+        auto& index = islandOf[findRoot(parents, cols[0])];
+        if (index == none) {
+            index = static_cast<unsigned>(count++);
+            if (islands.size() < count) {
+                if (spareIslands.empty()) {
+                    islands.emplace_back();
+                } else {
+                    islands.push_back(move(spareIslands.back()));
+                    spareIslands.pop_back();
+                }
             }
+            auto& island = islands[index];
+            island.rows.clear();
+            island.components.clear();
+            island.entries.clear();
         }
+        islands[index].rows.push_back(static_cast<unsigned>(r));
+    }
+    while (islands.size() > count) {
+        spareIslands.push_back(move(islands.back()));
+        islands.pop_back();
+    }
 
-        Vec C(numConstraints);
-        Vec C_dt(numConstraints);
-        SparseMatrix J(numConstraints, scope.xs.size());
-        SparseMatrix J_dt(numConstraints, scope.xs.size());
-        {
-            size_t i = 0;
-            for (auto& [c, mappings] : constraints) {
-                for (auto& m : mappings) {
-                    auto ccomponents = span{components}.subspan(m.componentOffset, m.componentCount);
-                    auto mapped = Constraint::map(scope, ccomponents, m.paramOffset, m.paramCount);
-
-                    auto localC = c->computeC(mapped);
-                    auto localC_dt = c->computeC_dt(mapped);
-                    auto localJ = c->computeJacobian(mapped);
-                    auto localJ_dt = c->computeJacobian_dt(mapped);
-                    C[i] = localC;
-                    C_dt[i] = localC_dt;
-                    for (size_t j = 0; j < ccomponents.size(); j++) {
-                        J.add(i, ccomponents[j], localJ[j]);
-                        J_dt.add(i, ccomponents[j], localJ_dt[j]);
-                    }
-                    i++;
+    auto localCols = arena.allocate<unsigned>(maxRowLength);
+    for (auto& island : islands) {
+        for (auto r : island.rows) {
+            for (auto c : J.getRowCols(r)) {
+                if (local[c] == none) {
+                    local[c] = static_cast<unsigned>(island.components.size());
+                    island.components.push_back(c);
                 }
             }
         }
+        island.J.resetPattern(island.components.size());
+        for (auto r : island.rows) {
+            auto cols = J.getRowCols(r);
+            for (size_t k = 0; k < cols.size(); k++)
+                localCols[k] = local[cols[k]];
+            island.J.addRow(localCols.first(cols.size()));
+            for (auto k = J.getRowStart(r); k < J.getRowStart(r + 1); k++)
+                island.entries.push_back(k);
+        }
+        island.J.finishPattern();
+    }
+}
+//---------------------------------------------------------------------------
+void Physics::solveIsland(Island& island, JobSystem* islandJobs)
+// Solve J W J^T lambda = b restricted to the island and write its constraint forces into tmpCols
+{
+    auto rows = island.rows.size();
+    auto cols = island.components.size();
+    for (size_t k = 0; k < island.entries.size(); k++)
+        island.J.values[k] = J.values[island.entries[k]];
+    island.W.resize(cols);
+    for (size_t c = 0; c < cols; c++)
+        island.W[c] = W[island.components[c]];
+    island.b.resize(rows);
+    for (size_t r = 0; r < rows; r++)
+        island.b[r] = b[island.rows[r]];
+
+    auto& JI = island.J;
+    auto& WI = island.W;
+    island.precond.build(preconditioner, JI, WI);
+    auto product = [&](const Vec& x, Vec& out) {
+        if (islandJobs) {
+            JI.dotT(x, island.tmpCols, *islandJobs);
+            island.tmpCols *= WI;
+            JI.dot(island.tmpCols, out, *islandJobs);
+        } else {
+            JI.dotT(x, island.tmpCols);
+            island.tmpCols *= WI;
+            JI.dot(island.tmpCols, out);
+        }
+    };
+    auto applyPreconditioner = [&](const Vec& r, Vec& z) { island.precond.apply(r, z); };
+    // With PHYSMAN_FLOAT the copy would hold the same values, and the refinement would only stall at the float residual
+    if (mixedPrecision && !is_same_v<lownum, num>) {
+        JI.updateLowValues();
+        auto lowProduct = [&](const Vec& x, Vec& out) {
+            if (islandJobs) {
+                JI.dotTLow(x, island.tmpCols, *islandJobs);
+                island.tmpCols *= WI;
+                JI.dotLow(island.tmpCols, out, *islandJobs);
+            } else {
+                JI.dotTLow(x, island.tmpCols);
+                island.tmpCols *= WI;
+                JI.dotLow(island.tmpCols, out);
+            }
+        };
+        island.solveStats = Algorithm::solveRefined(island.b, island.lambda, product, lowProduct, applyPreconditioner, solveOptions, island.solveWorkspace, islandJobs);
+    } else {
+        island.solveStats = Algorithm::solve(island.b, island.lambda, product, applyPreconditioner, solveOptions, island.solveWorkspace, islandJobs);
+    }
+    // Qhat, the islands have disjoint components
+    if (islandJobs)
+        JI.dotT(island.lambda, island.qhat, *islandJobs);
+    else
+        JI.dotT(island.lambda, island.qhat);
+    for (size_t c = 0; c < cols; c++)
+        tmpCols[island.components[c]] = island.qhat[c];
+}
+//---------------------------------------------------------------------------
+void Physics::computeDerivative(const Vec& state, num t, Vec& deriv)
+// Compute the velocities and accelerations, including the constraint forces
+{
+    TraceScope derivativeTrace("derivative");
+    auto n = capacity();
+    auto xs = span{state}.first(n);
+    auto vs = span{state}.subspan(n, n);
+
+    // Forces are evaluated in parallel into one slot per instance, then summed in instance order
+    Q.assign(n, 0);
+    {
+        ScopedTimer timer(stats.seconds.forces);
+        TraceScope trace("forces");
+        for (auto& group : forces.groups) {
+            forceVals.resize(group.activeCount * group.componentCount);
+            jobs.parallelFor(group.activeCount, forceGrain, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    group.type->computeQ({xs, vs, group.getActiveComponents(i), group.getActiveParams(i), t}, span{forceVals}.subspan(i * group.componentCount, group.componentCount));
+            });
+            for (size_t j = 0; j < forceVals.size(); j++)
+                Q[group.activeComponents[j]] += forceVals[j];
+        }
+    }
+
+    auto numConstraints = J.rows();
+    C.resize(numConstraints);
+    C_dt.resize(numConstraints);
+    {
+        ScopedTimer timer(stats.seconds.constraints);
+        TraceScope trace("constraints");
+        size_t maxChunks = 0;
+        for (auto* set : {&constraints, &contacts})
+            for (auto& group : set->groups)
+                maxChunks = max(maxChunks, JobSystem::numChunks(group.activeCount, constraintGrain));
+        if (gathers.size() < maxChunks)
+            gathers.resize(maxChunks);
+        // Each group covers consecutive rows, its Jacobian entries are contiguous in J. Chunks write disjoint rows
+        size_t row = 0;
+        for (auto* set : {&constraints, &contacts}) {
+            for (auto& group : set->groups) {
+                auto count = group.activeCount;
+                jobs.parallelFor(count, constraintGrain, [&](size_t begin, size_t end) {
+                    auto& buffers = gathers[begin / constraintGrain];
+                    auto chunk = end - begin;
+                    auto components = span{group.activeComponents}.subspan(begin * group.componentCount, chunk * group.componentCount);
+                    auto params = span{group.activeParams}.subspan(begin * group.paramCount, chunk * group.paramCount);
+                    Constraint::gather(xs, vs, components, group.componentCount, params, group.paramCount, buffers.xs, buffers.vs, buffers.ps);
+                    BatchScope batch{buffers.xs.data(), buffers.vs.data(), buffers.ps.data(), t, chunk};
+                    auto start = J.getRowStart(row + begin);
+                    auto entries = chunk * group.componentCount;
+                    group.type->computeBatch(batch, span{C}.subspan(row + begin, chunk), span{C_dt}.subspan(row + begin, chunk), span{J.values}.subspan(start, entries));
+                });
+                row += count;
+            }
+        }
+    }
+    {
+        ScopedTimer timer(stats.seconds.rhs);
+        TraceScope trace("rhs");
         num ks = 1000.0;
         num kd = 10.0;
-        auto b = -J_dt.dot(scope.vs) - J.dot(W * Q) - ks * C - kd * C_dt;
-        auto lamb = Algorithm::solve(b, [&](const Vec& lamb) {
-            return J.dot(W * J.dotT(lamb));
+        // b = -J v - J W Q - ks C - kd C_dt. The exact velocity term dC' / dx v would make J W J^T singular for the squared constraints,
+        // whose Jacobian vanishes where they are satisfied, e.g. the fixed point. J v damps the constraint velocity instead
+        J.dot(vs, b, jobs);
+        tmpCols.resize(n);
+        for (size_t i = 0; i < n; i++)
+            tmpCols[i] = W[i] * Q[i];
+        J.dot(tmpCols, tmpRows, jobs);
+        for (size_t i = 0; i < numConstraints; i++)
+            b[i] = -b[i] - tmpRows[i] - ks * C[i] - kd * C_dt[i];
+    }
+
+    // Large islands use all threads for their solve, the small ones are solved in parallel
+    {
+        ScopedTimer timer(stats.seconds.solve);
+        TraceScope trace("solve");
+        tmpCols.assign(n, 0);
+        for (auto& island : islands)
+            if (island.rows.size() >= largeIslandRows)
+                solveIsland(island, &jobs);
+        jobs.parallelFor(islands.size(), 1, [&](size_t begin, size_t end) {
+            for (auto i = begin; i < end; i++)
+                if (islands[i].rows.size() < largeIslandRows)
+                    solveIsland(islands[i], nullptr);
         });
-        auto Qhat = J.dotT(lamb);
+    }
+    if constexpr (statsEnabled) {
+        PhysicsStats::Stage stage;
+        for (auto& island : islands) {
+            auto& solveStats = island.solveStats;
+            stage.cgIterations += solveStats.iterations;
+            stage.maxResidual = max(stage.maxResidual, solveStats.residual);
+            stats.unconverged += !solveStats.converged;
+            stats.seconds.solveProducts += solveStats.productSeconds;
+            stats.seconds.solvePreconditioner += solveStats.preconditionerSeconds;
+        }
+        stats.stages.push_back(stage);
+        stats.solves += islands.size();
+        stats.cgIterations += stage.cgIterations;
+        stats.maxResidual = max(stats.maxResidual, stage.maxResidual);
+    }
 
-        Vec deriv = Vec::concat(scope.vs, (Q + Qhat) * W);
-        return deriv;
-    });
-    t += h;
+    deriv.resize(2 * n);
+    for (size_t i = 0; i < n; i++) {
+        deriv[i] = vs[i];
+        deriv[n + i] = (Q[i] + tmpCols[i]) * W[i];
+    }
+}
+//---------------------------------------------------------------------------
+OdeStats Physics::step(num h)
+// The timings and counters of the previous step are reset, the instance counts only change with the pattern
+{
+    arena.reset();
+    size_t allocations = 0;
+    if constexpr (statsEnabled) {
+        allocations = allocationCount();
+        stats.seconds = {};
+        stats.stages.clear();
+        stats.solves = 0;
+        stats.cgIterations = 0;
+        stats.unconverged = 0;
+        stats.maxResidual = 0;
+    }
+    OdeStats odeStats;
+    {
+        ScopedTimer timer(stats.seconds.total);
+        TraceScope trace("step");
+        if (patternDirty || contactsChanged() || J.cols() != capacity()) {
+            ScopedTimer patternTimer(stats.seconds.pattern);
+            TraceScope patternTrace("pattern");
+            buildPattern();
+        }
+        assert(J.rows() <= numConstraints());
+        W.resize(capacity());
+        for (size_t i = 0; i < W.size(); i++)
+            W[i] = 1 / ms[i];
+        odeStats = Algorithm::ode(state, t, h, [&](const Vec& state, num t, Vec& deriv) { computeDerivative(state, t, deriv); }, odeWorkspace, integrator, adaptiveOptions);
+        t += h;
+        ScopedTimer sleepTimer(stats.seconds.sleep);
+        TraceScope sleepTrace("sleep");
+        updateSleep(h);
+    }
+    if constexpr (statsEnabled) {
+        stats.allocations = allocationCount() - allocations;
+        stats.arenaBytes = arena.getUsed();
+        stats.arenaPeak = arena.getPeak();
+    }
+    return odeStats;
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Physics") {
+    using Catch::Approx;
+    Physics phys;
+    num x0[] = {0, 0, 0}, v0[] = {0, 0, 0}, m[] = {1, 1, 1};
+    num x1[] = {1, 0, 0}, v1[] = {0, 1, 0};
+    auto a = phys.addComponents(x0, v0, m);
+    auto b = phys.addComponents(x1, v1, m);
+    REQUIRE(a == 0);
+    REQUIRE(b == 3);
+    REQUIRE(phys.vs()[b + 1] == Approx(1.0));
+
+    auto fixed = phys.addConstraint(Constraint::getFixed(), {a, a + 1, a + 2}, {0.0, 0.0, 0.0});
+    auto gravity = phys.addForce(Force::getConstant(), {b, b + 1, b + 2}, {0.0, -10.0, 0.0});
+    phys.addContact(Constraint::getDistance2(), {a, a + 1, a + 2, b, b + 1, b + 2}, {1.0});
+    REQUIRE(phys.numConstraints() == 2);
+    REQUIRE(phys.numForces() == 1);
+
+    // Released components are reused and do not move
+    phys.removeConstraint(fixed);
+    phys.clearContacts();
+    phys.removeComponents(a, 3);
+    REQUIRE(phys.numConstraints() == 0);
+    auto c = phys.addComponents(x1, v0, m);
+    REQUIRE(c == a);
+
+    // A free falling component
+    phys.removeComponents(c, 3);
+    phys.step(0.5);
+    REQUIRE(phys.xs()[b] == Approx(1.0));
+    REQUIRE(phys.xs()[b + 1] == Approx(0.5 - 0.5 * 10 * 0.25));
+    REQUIRE(phys.xs()[a] == Approx(0.0));
+    phys.removeForce(gravity);
+    REQUIRE(phys.numForces() == 0);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Physics links") {
+    using Catch::Approx;
+    // Three pendulums share the Distance2 group. Removing the first link moves the last one into its place, its handle stays valid
+    Physics phys;
+    num m[] = {1, 1, 1}, v[] = {0, 0, 0};
+    vector<unsigned> anchors, ends;
+    vector<ConstraintId> links;
+    vector<ForceId> weights;
+    for (unsigned i = 0; i < 3; i++) {
+        num x0[] = {static_cast<num>(2 * i), 0, 0}, x1[] = {static_cast<num>(2 * i + 1), 0, 0};
+        auto a = phys.addComponents(x0, v, m);
+        auto b = phys.addComponents(x1, v, m);
+        phys.addConstraint(Constraint::getFixed(), {a, a + 1, a + 2}, {x0[0], 0.0, 0.0});
+        links.push_back(phys.addConstraint(Constraint::getDistance2(), {a, a + 1, a + 2, b, b + 1, b + 2}, {1.0}));
+        weights.push_back(phys.addForce(Force::getConstant(), {b, b + 1, b + 2}, {0.0, -10.0, 0.0}));
+        anchors.push_back(a);
+        ends.push_back(b);
+    }
+    auto length = [&](unsigned i) {
+        auto xs = phys.xs();
+        auto a = anchors[i], b = ends[i];
+        return std::sqrt((xs[b] - xs[a]) * (xs[b] - xs[a]) + (xs[b + 1] - xs[a + 1]) * (xs[b + 1] - xs[a + 1]) + (xs[b + 2] - xs[a + 2]) * (xs[b + 2] - xs[a + 2]));
+    };
+    phys.removeConstraint(links[0]);
+    for (unsigned i = 0; i < 10; i++)
+        phys.step(0.01);
+    REQUIRE(phys.xs()[ends[0] + 1] == Approx(-0.5 * 10 * 0.1 * 0.1));
+    REQUIRE(length(1) == Approx(1.0).margin(0.01));
+    REQUIRE(length(2) == Approx(1.0).margin(0.01));
+
+    // The moved link is removed with its own handle, its pendulum falls from there
+    auto y = phys.xs()[ends[2] + 1];
+    phys.removeConstraint(links[2]);
+    REQUIRE(phys.numConstraints() == 4);
+    for (unsigned i = 0; i < 10; i++)
+        phys.step(0.01);
+    REQUIRE(phys.xs()[ends[2] + 1] < y);
+    REQUIRE(length(1) == Approx(1.0).margin(0.01));
+
+    // A body reusing the released components is not held by any link of the old one
+    phys.removeForce(weights[0]);
+    phys.removeComponents(ends[0], 3);
+    num x[] = {10, 0, 0};
+    auto c = phys.addComponents(x, v, m);
+    REQUIRE(c == ends[0]);
+    phys.step(0.1);
+    REQUIRE(phys.xs()[c] == 10);
+    REQUIRE(phys.xs()[c + 1] == 0);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Physics allocations") {
+    // A chain hanging from a fixed point with springs and contacts
+    Physics phys;
+    num m[] = {1, 1, 1};
+    vector<unsigned> offsets;
+    for (unsigned i = 0; i < 10; i++) {
+        num x[] = {static_cast<num>(i), 0, 0}, v[] = {0, 0, 0};
+        offsets.push_back(phys.addComponents(x, v, m));
+    }
+    phys.addConstraint(Constraint::getFixed(), {0u, 1u, 2u}, {0.0, 0.0, 0.0});
+    for (unsigned i = 1; i < offsets.size(); i++) {
+        auto a = offsets[i - 1], b = offsets[i];
+        phys.addConstraint(Constraint::getDistance2(), {a, a + 1, a + 2, b, b + 1, b + 2}, {1.0});
+        phys.addForce(Force::getSpring3(), {a, a + 1, a + 2, b, b + 1, b + 2}, {1.0, 0.1, 1.0});
+        phys.addForce(Force::getConstant(), {b, b + 1, b + 2}, {0.0, -10.0, 0.0});
+        phys.addContact(Constraint::getPlaneCollision1(), {b, b + 1, b + 2}, {0.0, 1.0, 0.0, -5.0});
+    }
+
+    // Warm up the buffers, then steps must not allocate
+    phys.step(0.01);
+    auto before = allocationCount();
+    for (unsigned i = 0; i < 3; i++)
+        phys.step(0.01);
+    REQUIRE(allocationCount() == before);
+
+    // Contacts that change every step rebuild the pattern and the islands, their temporaries come from the arena
+    auto setContacts = [&](unsigned step) {
+        phys.clearContacts();
+        for (unsigned i = step % 2 + 1; i < offsets.size(); i += 2) {
+            auto b = offsets[i];
+            phys.addContact(Constraint::getPlaneCollision1(), {b, b + 1, b + 2}, {0.0, 1.0, 0.0, -5.0});
+        }
+    };
+    for (unsigned i = 0; i < 2; i++) {
+        setContacts(i);
+        phys.step(0.01);
+    }
+    before = allocationCount();
+    for (unsigned i = 0; i < 4; i++) {
+        setContacts(i);
+        phys.step(0.01);
+    }
+    REQUIRE(allocationCount() == before);
+    if constexpr (statsEnabled) {
+        REQUIRE(phys.getStats().arenaBytes > 0);
+        REQUIRE(phys.getStats().arenaPeak >= phys.getStats().arenaBytes);
+    }
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Physics stats") {
+    // A chain of three with a contact, the counters describe the last step
+    Physics phys;
+    num m[] = {1, 1, 1};
+    unsigned offsets[3];
+    for (unsigned i = 0; i < 3; i++) {
+        num x[] = {static_cast<num>(i), 0, 0}, v[] = {0, 0, 0};
+        offsets[i] = phys.addComponents(x, v, m);
+        phys.addForce(Force::getConstant(), {offsets[i], offsets[i] + 1, offsets[i] + 2}, {0.0, -10.0, 0.0});
+    }
+    phys.addConstraint(Constraint::getFixed(), {0u, 1u, 2u}, {0.0, 0.0, 0.0});
+    for (unsigned i = 1; i < 3; i++) {
+        auto a = offsets[i - 1], b = offsets[i];
+        phys.addConstraint(Constraint::getDistance2(), {a, a + 1, a + 2, b, b + 1, b + 2}, {1.0});
+    }
+    phys.addContact(Constraint::getPlaneCollision1(), {offsets[2], offsets[2] + 1, offsets[2] + 2}, {0.0, 1.0, 0.0, -5.0});
+    phys.step(0.01);
+    phys.step(0.01);
+    if constexpr (!statsEnabled)
+        return;
+
+    auto& stats = phys.getStats();
+    REQUIRE(stats.constraints.size() == 2);
+    REQUIRE(stats.constraints[0].name == "fixed");
+    REQUIRE(stats.constraints[0].count == 1);
+    REQUIRE(stats.constraints[1].name == "distance2");
+    REQUIRE(stats.constraints[1].count == 2);
+    REQUIRE(stats.contacts.size() == 1);
+    REQUIRE(stats.contacts[0].name == "planeCollision1");
+    REQUIRE(stats.forces.size() == 1);
+    REQUIRE(stats.forces[0].count == 3);
+    REQUIRE(stats.nonzeros == 3 + 2 * 6 + 3);
+    // Four RK4 stages with one island each, the pattern was built in the first step
+    REQUIRE(stats.stages.size() == 4);
+    REQUIRE(stats.solves == 4);
+    size_t iterations = 0;
+    for (auto& stage : stats.stages)
+        iterations += stage.cgIterations;
+    REQUIRE(iterations == stats.cgIterations);
+    REQUIRE(stats.cgIterations > 0);
+    REQUIRE(stats.unconverged == 0);
+    REQUIRE(stats.seconds.pattern == 0);
+    REQUIRE(stats.seconds.solve > 0);
+    REQUIRE(stats.seconds.total >= stats.seconds.forces + stats.seconds.constraints + stats.seconds.rhs + stats.seconds.solve);
+    REQUIRE(stats.allocations == 0);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Physics threads") {
+    // A long chain spans several chunks per group and forms a large island, every thread count must give identical states
+    auto simulate = [](unsigned threads) {
+        Physics phys;
+        phys.setThreadCount(threads);
+        num m[] = {1, 1, 1};
+        unsigned prev = 0;
+        for (unsigned i = 0; i < 600; i++) {
+            num x[] = {static_cast<num>(i), 0, 0}, v[] = {0, 0, static_cast<num>(i % 3)};
+            auto offset = phys.addComponents(x, v, m);
+            if (i == 0) {
+                phys.addConstraint(Constraint::getFixed(), {offset, offset + 1, offset + 2}, {0.0, 0.0, 0.0});
+            } else {
+                phys.addConstraint(Constraint::getDistance2(), {prev, prev + 1, prev + 2, offset, offset + 1, offset + 2}, {1.0});
+                phys.addForce(Force::getSpring3(), {prev, prev + 1, prev + 2, offset, offset + 1, offset + 2}, {1.0, 0.1, 1.0});
+                phys.addContact(Constraint::getPlaneCollision1(), {offset, offset + 1, offset + 2}, {0.0, 1.0, 0.0, -5.0});
+            }
+            phys.addForce(Force::getConstant(), {offset, offset + 1, offset + 2}, {0.0, -10.0, 0.0});
+            prev = offset;
+        }
+        for (unsigned i = 0; i < 5; i++)
+            phys.step(0.01);
+        return phys.state;
+    };
+    auto serial = simulate(1);
+    for (unsigned threads : {2u, 4u}) {
+        auto parallel = simulate(threads);
+        REQUIRE(parallel.size() == serial.size());
+        for (size_t i = 0; i < serial.size(); i++)
+            REQUIRE(parallel[i] == serial[i]);
+    }
 }
 //---------------------------------------------------------------------------
-}
\ No newline at end of file
+TEST_CASE("math/Physics mixed precision") {
+    // A hanging chain solved with low precision Jacobian values stays close to the full precision solve and keeps the thread independence
+    using Catch::Approx;
+    auto simulate = [](bool mixed, unsigned threads) {
+        Physics phys;
+        phys.mixedPrecision = mixed;
+        phys.setThreadCount(threads);
+        num m[] = {1, 1, 1};
+        unsigned prev = 0;
+        for (unsigned i = 0; i < 100; i++) {
+            num x[] = {static_cast<num>(i), 0, 0}, v[] = {0, 0, 0};
+            auto offset = phys.addComponents(x, v, m);
+            if (i == 0)
+                phys.addConstraint(Constraint::getFixed(), {offset, offset + 1, offset + 2}, {0.0, 0.0, 0.0});
+            else
+                phys.addConstraint(Constraint::getDistance2(), {prev, prev + 1, prev + 2, offset, offset + 1, offset + 2}, {1.0});
+            phys.addForce(Force::getConstant(), {offset, offset + 1, offset + 2}, {0.0, -10.0, 0.0});
+            prev = offset;
+        }
+        for (unsigned i = 0; i < 5; i++)
+            phys.step(0.01);
+        REQUIRE(phys.getStats().unconverged == 0);
+        return phys.state;
+    };
+    auto full = simulate(false, 1);
+    auto mixed = simulate(true, 1);
+    for (size_t i = 0; i < full.size(); i++)
+        REQUIRE(mixed[i] == Approx(full[i]).margin(1e-4));
+    REQUIRE(simulate(true, 4) == mixed);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Physics islands") {
+    // Two unconnected chains are solved separately, each one moves as if it were alone
+    auto addChain = [](Physics& phys, num z) {
+        num m[] = {1, 1, 1};
+        unsigned prev = 0;
+        for (unsigned i = 0; i < 5; i++) {
+            num x[] = {static_cast<num>(i), 0, z}, v[] = {0, 0, 0};
+            auto offset = phys.addComponents(x, v, m);
+            if (i == 0)
+                phys.addConstraint(Constraint::getFixed(), {offset, offset + 1, offset + 2}, {0.0, 0.0, z});
+            else
+                phys.addConstraint(Constraint::getDistance2(), {prev, prev + 1, prev + 2, offset, offset + 1, offset + 2}, {1.0});
+            phys.addForce(Force::getConstant(), {offset, offset + 1, offset + 2}, {0.0, -10.0, 0.0});
+            prev = offset;
+        }
+    };
+    Physics alone, both;
+    addChain(alone, 0);
+    addChain(both, 0);
+    addChain(both, 3);
+    // A free component does not form an island
+    num x[] = {0, 0, 0}, m[] = {1, 1, 1};
+    both.addComponents(x, x, m);
+    for (unsigned i = 0; i < 10; i++) {
+        alone.step(0.01);
+        both.step(0.01);
+    }
+    REQUIRE(alone.numIslands() == 1);
+    REQUIRE(both.numIslands() == 2);
+    // One solve per island in each of the four RK4 evaluations
+    if constexpr (statsEnabled) {
+        REQUIRE(alone.getStats().solves == 4);
+        REQUIRE(both.getStats().solves == 8);
+        REQUIRE(both.getStats().cgIterations == 2 * alone.getStats().cgIterations);
+    }
+    for (unsigned i = 0; i < alone.numComponents(); i++) {
+        REQUIRE(both.xs()[i] == alone.xs()[i]);
+        REQUIRE(both.vs()[i] == alone.vs()[i]);
+    }
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Physics sleeping") {
+    using Catch::Approx;
+    // A particle resting on a plane falls asleep and is woken by a new force
+    Physics phys;
+    num x[] = {0, 0.1, 0}, v[] = {0, 0, 0}, m[] = {1, 1, 1};
+    auto a = phys.addComponents(x, v, m);
+    phys.addForce(Force::getConstant(), {a, a + 1, a + 2}, {0.0, -10.0, 0.0});
+    // A second particle that keeps moving
+    num x2[] = {5, 0, 0}, v2[] = {1, 0, 0};
+    auto b = phys.addComponents(x2, v2, m);
+    for (unsigned i = 0; i < 300; i++) {
+        phys.clearContacts();
+        phys.addContact(Constraint::getPlaneCollision1(), {a, a + 1, a + 2}, {0.0, 1.0, 0.0, 0.0});
+        phys.step(0.01);
+    }
+    REQUIRE(phys.isAsleep(a + 1));
+    REQUIRE(!phys.isAsleep(b));
+    REQUIRE(phys.xs()[b] == Approx(8.0));
+    auto rest = phys.xs()[a + 1];
+    REQUIRE(rest == Approx(0.0).margin(0.05));
+    phys.step(0.01);
+    REQUIRE(phys.xs()[a + 1] == rest);
+    REQUIRE(phys.vs()[a + 1] == 0);
+
+    phys.addForce(Force::getConstant(), {a, a + 1, a + 2}, {1.0, 0.0, 0.0});
+    REQUIRE(!phys.isAsleep(a));
+    phys.step(0.01);
+    REQUIRE(!phys.isAsleep(a + 1));
+    REQUIRE(phys.vs()[a] > 0);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Physics integrators", "[.][benchmark]") {
+    // Cost of a step against the energy drift over 10 seconds of a chain of undamped springs hanging from a fixed point
+    constexpr unsigned count = 20;
+    constexpr num ks = 100, g = 10;
+    auto makeChain = [&](Physics& phys, Integrator integrator) {
+        phys.integrator = integrator;
+        phys.setSleepOptions({.enabled = false});
+        num m[] = {1, 1, 1};
+        unsigned prev = 0;
+        for (unsigned i = 0; i < count; i++) {
+            num x[] = {static_cast<num>(i), 0, 0}, v[] = {0, 0, 0};
+            auto offset = phys.addComponents(x, v, m);
+            if (i == 0)
+                phys.addConstraint(Constraint::getFixed(), {offset, offset + 1, offset + 2}, {0.0, 0.0, 0.0});
+            else
+                phys.addForce(Force::getSpring3(), {prev, prev + 1, prev + 2, offset, offset + 1, offset + 2}, {ks, 0.0, 1.0});
+            phys.addForce(Force::getConstant(), {offset, offset + 1, offset + 2}, {0.0, -g, 0.0});
+            prev = offset;
+        }
+    };
+    auto energy = [&](Physics& phys) {
+        auto xs = phys.xs(), vs = phys.vs();
+        num e = 0;
+        for (unsigned i = 0; i < count; i++) {
+            auto c = 3 * i;
+            e += phys.ms[c] * (vs[c] * vs[c] + vs[c + 1] * vs[c + 1] + vs[c + 2] * vs[c + 2]) / 2 + phys.ms[c] * g * xs[c + 1];
+            if (i) {
+                auto dist = std::sqrt((xs[c] - xs[c - 3]) * (xs[c] - xs[c - 3]) + (xs[c + 1] - xs[c - 2]) * (xs[c + 1] - xs[c - 2]) + (xs[c + 2] - xs[c - 1]) * (xs[c + 2] - xs[c - 1]));
+                e += ks * (dist - 1) * (dist - 1) / 2;
+            }
+        }
+        return e;
+    };
+    pair<Integrator, const char*> integrators[] = {{Integrator::SymplecticEuler, "symplectic Euler"}, {Integrator::VelocityVerlet, "velocity Verlet"}, {Integrator::RK2, "RK2"}, {Integrator::RK4, "RK4"}};
+    num h = 1.0 / 64;
+    for (auto [integrator, name] : integrators) {
+        Physics phys;
+        makeChain(phys, integrator);
+        auto e0 = energy(phys);
+        for (unsigned i = 0; i < 640; i++)
+            phys.step(h);
+        fmt::print("{}: energy drift {:.4f}\n", name, energy(phys) - e0);
+        BENCHMARK(name) {
+            phys.step(h);
+        };
+    }
+}
+//---------------------------------------------------------------------------
+}
@@ -1,48 +1,279 @@
 #pragma once
 //---------------------------------------------------------------------------
 #include "math/Constraint.hpp"
+#include "math/Algorithm.hpp"
+#include "math/Arena.hpp"
 #include "math/Force.hpp"
-#include <unordered_map>
+#include "math/JobSystem.hpp"
+#include "math/Preconditioner.hpp"
+#include "math/SparseMatrix.hpp"
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
 //---------------------------------------------------------------------------
 namespace physman::math {
 //---------------------------------------------------------------------------
+/// Handle of a persistent constraint
+enum class ConstraintId : unsigned {};
+/// Handle of a persistent force
+enum class ForceId : unsigned {};
+//---------------------------------------------------------------------------
+/// Options for putting resting components to sleep
+struct SleepOptions {
+    bool enabled = true;
+    /// Kinetic energy per component below which components connected by constraints or forces count as resting
+    num energy = 1e-3;
+    /// Time they must rest before they fall asleep. They wake when an awake constraint or a new force reaches them
+    num delay = 1;
+};
+//---------------------------------------------------------------------------
+/// Work done by the last step. Timings and counters stay zero without PHYSMAN_STATS
+struct PhysicsStats {
+    /// Seconds spent in each phase of the step
+    struct Phases {
+        /// Collecting the awake instances, building the sparsity pattern and the islands
+        double pattern = 0;
+        double forces = 0;
+        /// Evaluating C, C' and the Jacobians
+        double constraints = 0;
+        /// Right hand side of the constraint force system
+        double rhs = 0;
+        /// Preconditioners and conjugate gradients of all islands
+        double solve = 0;
+        /// Sparse products and preconditioner applications inside the solves, summed over the islands
+        double solveProducts = 0;
+        double solvePreconditioner = 0;
+        double sleep = 0;
+        /// The whole step
+        double total = 0;
+    };
+    /// Conjugate gradients of one derivative evaluation, e.g. one of the four RK4 stages
+    struct Stage {
+        size_t cgIterations = 0;
+        num maxResidual = 0;
+    };
+    /// Awake instances of a constraint or force type
+    struct TypeCount {
+        std::string_view name;
+        size_t count = 0;
+    };
+    Phases seconds;
+    /// Derivative evaluations, one entry each
+    std::vector<Stage> stages;
+    /// Constraint force solves, one per island and derivative evaluation
+    size_t solves = 0;
+    /// Conjugate gradient iterations of all solves
+    size_t cgIterations = 0;
+    /// Solves that stopped at SolveOptions::maxIterations without converging
+    size_t unconverged = 0;
+    /// Largest final relative residual of a solve
+    num maxResidual = 0;
+    /// Nonzero entries of the constraint Jacobian
+    size_t nonzeros = 0;
+    std::vector<TypeCount> constraints, contacts, forces;
+    /// Heap allocations during the step, on all threads. Only counted with PHYSMAN_COUNT_ALLOCATIONS
+    size_t allocations = 0;
+    /// Bytes of temporaries the step took from the arena, and the most any step took so far. See Physics::reserveArena
+    size_t arenaBytes = 0;
+    size_t arenaPeak = 0;
+};
+//---------------------------------------------------------------------------
 class Physics {
-    struct Mapping {
-        unsigned componentOffset = 0;
+    /// All instances of a single constraint or force type
+    template <typename T>
+    struct Group {
+        const T* type = nullptr;
         unsigned componentCount = 0;
-        unsigned paramOffset = 0;
         unsigned paramCount = 0;
+        /// componentCount entries per instance
+        std::vector<unsigned> components;
+        /// paramCount entries per instance
+        Vec params;
+        /// The handle owning each instance
+        std::vector<unsigned> handles;
+        /// Components and parameters of the instances that are awake, rebuilt with the pattern
+        std::vector<unsigned> activeComponents;
+        Vec activeParams;
+        size_t activeCount = 0;
+        /// Components and parameters of all instances when the pattern was built, contacts are compared against them
+        std::vector<unsigned> patternComponents;
+        Vec patternParams;
+
+        size_t size() const { return handles.size(); }
+        std::span<const unsigned> getComponents(size_t i) const { return std::span{components}.subspan(i * componentCount, componentCount); }
+        std::span<const num> getParams(size_t i) const { return std::span{params}.subspan(i * paramCount, paramCount); }
+        std::span<const unsigned> getActiveComponents(size_t i) const { return std::span{activeComponents}.subspan(i * componentCount, componentCount); }
+        std::span<const num> getActiveParams(size_t i) const { return std::span{activeParams}.subspan(i * paramCount, paramCount); }
     };
-    std::vector<unsigned> components;
-    Vec params;
-    size_t numConstraints = 0;
-    size_t numForces = 0;
+    /// Instances of constraints or forces, grouped by type and addressable by handle
+    template <typename T>
+    struct InstanceSet {
+        std::vector<Group<T>> groups;
+        /// Handle -> (group, index in group)
+        std::vector<std::pair<unsigned, unsigned>> slots;
+        std::vector<unsigned> freeSlots;
+        size_t count = 0;
 
-    std::unordered_map<const Constraint*, std::vector<Mapping>> constraints;
-    std::unordered_map<const Force*, std::vector<Mapping>> forces;
+        unsigned add(const T* type, std::span<const unsigned> cs, std::span<const num> ps);
+        void remove(unsigned handle);
+        /// Remove the instances whose components match pred, the others keep their order and handles
+        template <typename Pred>
+        void removeIf(Pred pred);
+        void clear();
+    };
 
+    InstanceSet<Constraint> constraints;
+    InstanceSet<Constraint> contacts;
+    InstanceSet<Force> forces;
+    /// Released component ranges (offset, count)
+    std::vector<std::pair<unsigned, unsigned>> freeComponents;
+    /// Number of components in use (including released ones)
+    unsigned numComps = 0;
+    /// Constraint Jacobian, its sparsity pattern is kept until the constraints change
+    SparseMatrix J;
+    bool patternDirty = true;
+    /// Components connected by constraints, solved independently of the others
+    struct Island {
+        /// Rows of J in this island
+        std::vector<unsigned> rows;
+        /// Component of each column of the island's matrix
+        std::vector<unsigned> components;
+        /// Offset into J.values of each entry of the island's matrix
+        std::vector<unsigned> entries;
+        /// Rows of J restricted to the island's components
+        SparseMatrix J;
+        Preconditioner precond;
+        SolveWorkspace solveWorkspace;
+        Vec W, b, lambda, qhat, tmpCols;
+        /// Convergence of the last solve
+        SolveStats solveStats;
+    };
+    std::vector<Island> islands;
+    /// Islands that are not in use, kept with their buffers for later patterns
+    std::vector<Island> spareIslands;
+    /// Union-find parents of the components, only used while building the islands
+    std::vector<unsigned> parents;
+    /// How long each component has been resting, it sleeps once this reaches sleepOptions.delay
+    Vec idleTimes;
+    /// Components of the awake groups connected by constraints or forces, in group order
+    std::vector<unsigned> sleepMembers;
+    /// Offset of each awake group in sleepMembers, one more entry than groups
+    std::vector<unsigned> sleepGroupStart;
+    /// Scratch space for gathering the constraint inputs of one chunk
+    struct GatherBuffers {
+        Vec xs, vs, ps;
+    };
+    std::vector<GatherBuffers> gathers;
+    JobSystem jobs;
+    /// Buffers of step, kept so that steady state steps do not allocate
+    OdeWorkspace odeWorkspace;
+    Vec W, Q, forceVals, C, C_dt, b, tmpRows, tmpCols;
+    /// Temporaries of the current step, reset at its start
+    Arena arena;
+    PhysicsStats stats;
+    SleepOptions sleepOptions;
+
+    void reserveComponents(unsigned capacity);
+    void buildPattern();
+    bool contactsChanged() const;
+    void buildSleepGroups();
+    void buildIslands();
+    void updateSleep(num h);
+    void wake(std::span<const unsigned> components);
+    void solveIsland(Island& island, JobSystem* islandJobs);
+    void computeDerivative(const Vec& state, num t, Vec& deriv);
 
     public:
-    /// xs and vs
+    /// xs and vs, each with capacity() entries
     Vec state;
     Vec ms;
     num t = 0;
+    /// Options for solving the constraint forces
+    SolveOptions solveOptions;
+    /// Preconditioner for solving the constraint forces. Each constraint is one row, so BlockJacobi would couple whichever constraints happen to be neighbours in the pattern
+    Preconditioner::Type preconditioner = Preconditioner::Type::Jacobi;
+    /// Run the conjugate gradients on a lownum copy of the Jacobian and refine the result with the full one, see Algorithm::solveRefined.
+    /// Off by default, the float products only pay off where the value traffic dominates the gathers. Ignored with PHYSMAN_FLOAT, where both are float
+    bool mixedPrecision = false;
+    /// Integration scheme of step
+    Integrator integrator = Integrator::RK4;
+    /// Error control of the adaptive integrators
+    AdaptiveOptions adaptiveOptions;
 
+    Physics();
     Physics(const Vec& xs, const Vec& vs, Vec ms, num t);
     ~Physics() noexcept;
+
+    /// Add components with the given positions, velocities and masses. Returns the offset of the first component
+    unsigned addComponents(std::span<const num> xs, std::span<const num> vs, std::span<const num> ms);
+    /// Release components. Must no longer be referenced by forces or constraints
+    void removeComponents(unsigned offset, unsigned count);
+    /// Wake components and everything connected to them, e.g. after changing their state directly
+    void wake(unsigned offset, unsigned count);
+    /// Options for putting resting components to sleep
+    const SleepOptions& getSleepOptions() const { return sleepOptions; }
+    /// Change the sleep options. Turning sleep on or off restarts the resting times of all components
+    void setSleepOptions(const SleepOptions& options);
+    /// Whether a component is asleep, sleeping components are not simulated
+    bool isAsleep(unsigned component) const { return sleepOptions.enabled && idleTimes[component] >= sleepOptions.delay; }
+    /// Number of components in use, component offsets are always below this
+    unsigned numComponents() const { return numComps; }
+    /// Size of the position and velocity halves of the state
+    unsigned capacity() const { return static_cast<unsigned>(state.size() / 2); }
+    /// Positions
+    std::span<num> xs() { return std::span{state}.first(capacity()); }
+    /// Velocities
+    std::span<num> vs() { return std::span{state}.subspan(capacity(), capacity()); }
+
     template <size_t N1, size_t N2>
-    void addConstraint(const Constraint* constraint, const unsigned (&components)[N1], const num (&params)[N2]) {
+    ConstraintId addConstraint(const Constraint* constraint, const unsigned (&components)[N1], const num (&params)[N2]) {
         return addConstraint(constraint, std::span<const unsigned>{components, components + N1}, std::span<const num>{params, params + N2});
     }
-    void addConstraint(const Constraint* constraint, std::span<const unsigned> components, std::span<const num> params);
+    /// Add a persistent constraint
+    ConstraintId addConstraint(const Constraint* constraint, std::span<const unsigned> components, std::span<const num> params);
+    /// Remove a persistent constraint
+    void removeConstraint(ConstraintId id);
+    template <size_t N1, size_t N2>
+    void addContact(const Constraint* constraint, const unsigned (&components)[N1], const num (&params)[N2]) {
+        return addContact(constraint, std::span<const unsigned>{components, components + N1}, std::span<const num>{params, params + N2});
+    }
+    /// Add a constraint that only lives until the next clearContacts or clearAwakeContacts.
+    /// Contacts are meant to be found anew for every step, the pattern is only rebuilt if they differ from those of the last pattern
+    void addContact(const Constraint* constraint, std::span<const unsigned> components, std::span<const num> params);
+    /// Remove all contacts
+    void clearContacts();
+    /// Remove the contacts with an awake component. Contacts between sleeping components stay, their components have not moved
+    void clearAwakeContacts();
     template <size_t N1, size_t N2>
-    void addForce(const Force* force, const unsigned (&components)[N1], const num (&params)[N2]) {
+    ForceId addForce(const Force* force, const unsigned (&components)[N1], const num (&params)[N2]) {
         return addForce(force, std::span<const unsigned>{components, components + N1}, std::span<const num>{params, params + N2});
     }
-    void addForce(const Force* force, std::span<const unsigned> components, std::span<const num> params);
+    /// Add a persistent force
+    ForceId addForce(const Force* force, std::span<const unsigned> components, std::span<const num> params);
+    /// Remove a persistent force
+    void removeForce(ForceId id);
+
+    /// Number of constraints, including contacts
+    size_t numConstraints() const { return constraints.count + contacts.count; }
+    size_t numContacts() const { return contacts.count; }
+    /// Number of forces
+    size_t numForces() const { return forces.count; }
+    /// Number of groups of components connected by constraints, as of the last step
+    size_t numIslands() const { return islands.size(); }
+
+    /// Number of threads evaluating constraints and forces and solving for the constraint forces, 0 uses all hardware threads. The results do not depend on it
+    void setThreadCount(unsigned threads) { jobs.setThreadCount(threads); }
+    unsigned getThreadCount() const { return jobs.getThreadCount(); }
 
-    void step(num h);
+    /// Work done by the last step
+    const PhysicsStats& getStats() const { return stats; }
+    /// Make room for the temporaries of a step up front, e.g. PhysicsStats::arenaPeak of a representative run
+    void reserveArena(size_t bytes) { arena.reserve(bytes); }
+
+    /// Advance the simulation by h. Returns the substeps taken, more than one only for adaptive integrators
+    OdeStats step(num h);
 };
 //---------------------------------------------------------------------------
 }
-//---------------------------------------------------------------------------
\ No newline at end of file
+//---------------------------------------------------------------------------
@@ -0,0 +1,173 @@
+#include "math/Preconditioner.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Invert a small dense row major matrix in place with Gauss-Jordan elimination, returns false if it is singular
+static bool invert(std::span<num> a, unsigned n) {
+    num tmp[9 * 9];
+    assert(n <= 9);
+    std::span<num> inv{tmp, n * n};
+    ranges::fill(inv, 0);
+    for (unsigned i = 0; i < n; i++)
+        inv[i * n + i] = 1;
+    for (unsigned col = 0; col < n; col++) {
+        auto pivot = col;
+        for (auto row = col + 1; row < n; row++)
+            if (abs(a[row * n + col]) > abs(a[pivot * n + col]))
+                pivot = row;
+        if (abs(a[pivot * n + col]) < numeric_limits<num>::epsilon())
+            return false;
+        if (pivot != col) {
+            swap_ranges(a.begin() + pivot * n, a.begin() + pivot * n + n, a.begin() + col * n);
+            swap_ranges(inv.begin() + pivot * n, inv.begin() + pivot * n + n, inv.begin() + col * n);
+        }
+        auto scale = 1 / a[col * n + col];
+        for (unsigned k = 0; k < n; k++) {
+            a[col * n + k] *= scale;
+            inv[col * n + k] *= scale;
+        }
+        for (unsigned row = 0; row < n; row++) {
+            if (row == col)
+                continue;
+            auto f = a[row * n + col];
+            if (f == 0)
+                continue;
+            for (unsigned k = 0; k < n; k++) {
+                a[row * n + k] -= f * a[col * n + k];
+                inv[row * n + k] -= f * inv[col * n + k];
+            }
+        }
+    }
+    ranges::copy(inv, a.begin());
+    return true;
+}
+//---------------------------------------------------------------------------
+void Preconditioner::buildBlock(const SparseMatrix& J, const Vec& W, size_t first, unsigned count, std::span<num> out)
+// Compute and invert the block of J W J^T for rows [first, first + count)
+{
+    ranges::fill(out, 0);
+    for (unsigned i = 0; i < count; i++) {
+        auto colsI = J.getRowCols(first + i);
+        auto valsI = J.getRowValues(first + i);
+        for (unsigned j = i; j < count; j++) {
+            auto colsJ = J.getRowCols(first + j);
+            auto valsJ = J.getRowValues(first + j);
+            num sum = 0;
+            for (size_t a = 0; a < colsI.size(); a++)
+                for (size_t b = 0; b < colsJ.size(); b++)
+                    if (colsI[a] == colsJ[b])
+                        sum += valsI[a] * W[colsI[a]] * valsJ[b];
+            out[i * count + j] = sum;
+            out[j * count + i] = sum;
+        }
+    }
+    // Rows without any entries (e.g. inactive contacts) are left untouched
+    for (unsigned i = 0; i < count; i++)
+        if (out[i * count + i] == 0)
+            out[i * count + i] = 1;
+
+    num diagonal[9];
+    for (unsigned i = 0; i < count; i++)
+        diagonal[i] = out[i * count + i];
+    if (!invert(out, count)) {
+        // Dependent rows, fall back to the diagonal
+        ranges::fill(out, 0);
+        for (unsigned i = 0; i < count; i++)
+            out[i * count + i] = 1 / diagonal[i];
+    }
+}
+//---------------------------------------------------------------------------
+void Preconditioner::build(Type type, const SparseMatrix& J, const Vec& W, unsigned blockSize)
+// Set up the preconditioner for J W J^T
+{
+    assert(W.size() == J.cols());
+    assert(blockSize >= 1 && blockSize <= 9);
+    this->type = type;
+    this->size = J.rows();
+    this->blockSize = type == Type::BlockJacobi ? blockSize : 1;
+    if (type == Type::None)
+        return;
+
+    inverses.resize((size + this->blockSize - 1) / this->blockSize * this->blockSize * this->blockSize);
+    for (size_t first = 0, block = 0; first < size; first += this->blockSize, block++) {
+        auto count = static_cast<unsigned>(min<size_t>(this->blockSize, size - first));
+        auto out = std::span{inverses}.subspan(block * this->blockSize * this->blockSize, count * count);
+        buildBlock(J, W, first, count, out);
+    }
+}
+//---------------------------------------------------------------------------
+Vec Preconditioner::apply(const Vec& r) const
+// Compute M^-1 r
+{
+    Vec z;
+    apply(r, z);
+    return z;
+}
+//---------------------------------------------------------------------------
+void Preconditioner::apply(const Vec& r, Vec& z) const
+// Compute M^-1 r into z
+{
+    assert(r.size() == size);
+    z.resize(size);
+    if (type == Type::None) {
+        ranges::copy(r, z.begin());
+        return;
+    }
+    if (blockSize == 1) {
+        for (size_t i = 0; i < size; i++)
+            z[i] = r[i] * inverses[i];
+        return;
+    }
+
+    for (size_t first = 0, block = 0; first < size; first += blockSize, block++) {
+        auto count = min<size_t>(blockSize, size - first);
+        auto* inv = inverses.data() + block * blockSize * blockSize;
+        for (size_t i = 0; i < count; i++) {
+            num sum = 0;
+            for (size_t j = 0; j < count; j++)
+                sum += inv[i * count + j] * r[first + j];
+            z[first + i] = sum;
+        }
+    }
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Preconditioner") {
+    using Catch::Approx;
+    // J = | 1 1 0 |
+    //     | 0 1 1 |
+    //     | 0 0 0 |
+    SparseMatrix J;
+    J.resetPattern(3);
+    unsigned cols[] = {0, 1, 1, 2, 0, 2};
+    J.addRows(cols, 2);
+    J.finishPattern();
+    ranges::copy(Vec{1, 1, 1, 1, 0, 0}, J.values.begin());
+    Vec W{1, 2, 1};
+    // J W J^T = | 3 2 0 |
+    //           | 2 3 0 |
+    //           | 0 0 0 |
+    Preconditioner jacobi;
+    jacobi.build(Preconditioner::Type::Jacobi, J, W);
+    auto z = jacobi.apply({3, 6, 5});
+    REQUIRE(z[0] == Approx(1.0));
+    REQUIRE(z[1] == Approx(2.0));
+    REQUIRE(z[2] == Approx(5.0));
+
+    Preconditioner block;
+    block.build(Preconditioner::Type::BlockJacobi, J, W, 2);
+    // Exact inverse for the first block
+    auto z2 = block.apply({5, 5, 4});
+    REQUIRE(z2[0] == Approx(1.0));
+    REQUIRE(z2[1] == Approx(1.0));
+    REQUIRE(z2[2] == Approx(4.0));
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
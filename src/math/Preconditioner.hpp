@@ -0,0 +1,41 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "math/Num.hpp"
+#include "math/SparseMatrix.hpp"
+#include "math/Vec.hpp"
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// (Block) Jacobi preconditioner for systems of the form J W J^T with diagonal W
+class Preconditioner {
+    public:
+    enum class Type {
+        None,
+        /// Inverse of the diagonal of J W J^T
+        Jacobi,
+        /// Inverse of blocks of consecutive rows along the diagonal of J W J^T. Only helps if the rows of a block belong together, e.g. the rows of one body
+        BlockJacobi
+    };
+
+    private:
+    Type type = Type::None;
+    unsigned blockSize = 1;
+    size_t size = 0;
+    /// Inverted diagonal blocks, blockSize * blockSize entries per block in row major order
+    Vec inverses;
+
+    void buildBlock(const SparseMatrix& J, const Vec& W, size_t first, unsigned count, std::span<num> out);
+
+    public:
+    /// Set up the preconditioner for J W J^T
+    void build(Type type, const SparseMatrix& J, const Vec& W, unsigned blockSize = 3);
+    /// Get the type
+    Type getType() const { return type; }
+    /// Compute M^-1 r
+    Vec apply(const Vec& r) const;
+    /// Compute M^-1 r into z
+    void apply(const Vec& r, Vec& z) const;
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
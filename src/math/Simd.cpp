@@ -0,0 +1,342 @@
+#include "math/Simd.hpp"
+#include "math/Vec.hpp"
+#include <atomic>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(__EMSCRIPTEN__)
+#define PHYSMAN_SIMD_X86 1
+#include <immintrin.h>
+#endif
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman::simd {
+//---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+/// One implementation of all kernels
+struct Kernels {
+    num (*dot)(const num*, const num*, size_t);
+    void (*axpy)(num, const num*, num*, size_t);
+    void (*aypx)(num, const num*, num*, size_t);
+    void (*apply)(Op, num*, const num*, size_t);
+    void (*applyScalar)(Op, num*, num, size_t);
+    void (*spmv)(const unsigned*, const unsigned*, const num*, const num*, num*, size_t);
+};
+//---------------------------------------------------------------------------
+/// Scalar operation, used for the tails of the vector kernels
+inline num compute(Op op, num a, num b) {
+    switch (op) {
+        case Op::Add: return a + b;
+        case Op::Sub: return a - b;
+        case Op::Mul: return a * b;
+        case Op::Div: return a / b;
+    }
+    return a;
+}
+//---------------------------------------------------------------------------
+namespace scalar {
+num dot(const num* a, const num* b, size_t n) {
+    num sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+void axpy(num alpha, const num* x, num* y, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] += alpha * x[i];
+}
+void aypx(num alpha, const num* x, num* y, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] = x[i] + alpha * y[i];
+}
+void apply(Op op, num* y, const num* x, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] = compute(op, y[i], x[i]);
+}
+void applyScalar(Op op, num* y, num s, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] = compute(op, y[i], s);
+}
+void spmv(const unsigned* rowStart, const unsigned* cols, const num* values, const num* v, num* out, size_t rows) {
+    for (size_t r = 0; r < rows; r++) {
+        num sum = 0;
+        for (auto k = rowStart[r]; k < rowStart[r + 1]; k++)
+            sum += values[k] * v[cols[k]];
+        out[r] = sum;
+    }
+}
+constexpr Kernels kernels{dot, axpy, aypx, apply, applyScalar, spmv};
+}
+//---------------------------------------------------------------------------
+#ifdef PHYSMAN_SIMD_X86
+// Each instruction set gets the same kernels on its register type. The target attributes allow
+// compiling them without raising the baseline instruction set of the whole program.
+#define PHYSMAN_SIMD_KERNELS(NS, TARGET, REG, LANES, LOAD, STORE, SET1, ZERO, ADD, SUB, MUL, DIV, HSUM, GATHER)         \
+    namespace NS {                                                                                                       \
+    TARGET num dot(const num* a, const num* b, size_t n) {                                                              \
+        REG acc0 = ZERO(), acc1 = ZERO();                                                                                \
+        size_t i = 0;                                                                                                    \
+        for (; i + 2 * LANES <= n; i += 2 * LANES) {                                                                     \
+            acc0 = ADD(acc0, MUL(LOAD(a + i), LOAD(b + i)));                                                             \
+            acc1 = ADD(acc1, MUL(LOAD(a + i + LANES), LOAD(b + i + LANES)));                                             \
+        }                                                                                                                \
+        for (; i + LANES <= n; i += LANES)                                                                               \
+            acc0 = ADD(acc0, MUL(LOAD(a + i), LOAD(b + i)));                                                             \
+        num sum = HSUM(ADD(acc0, acc1));                                                                                 \
+        for (; i < n; i++)                                                                                               \
+            sum += a[i] * b[i];                                                                                          \
+        return sum;                                                                                                      \
+    }                                                                                                                    \
+    TARGET void axpy(num alpha, const num* x, num* y, size_t n) {                                                       \
+        REG va = SET1(alpha);                                                                                            \
+        size_t i = 0;                                                                                                    \
+        for (; i + LANES <= n; i += LANES)                                                                               \
+            STORE(y + i, ADD(LOAD(y + i), MUL(va, LOAD(x + i))));                                                        \
+        for (; i < n; i++)                                                                                               \
+            y[i] += alpha * x[i];                                                                                        \
+    }                                                                                                                    \
+    TARGET void aypx(num alpha, const num* x, num* y, size_t n) {                                                       \
+        REG va = SET1(alpha);                                                                                            \
+        size_t i = 0;                                                                                                    \
+        for (; i + LANES <= n; i += LANES)                                                                               \
+            STORE(y + i, ADD(LOAD(x + i), MUL(va, LOAD(y + i))));                                                        \
+        for (; i < n; i++)                                                                                               \
+            y[i] = x[i] + alpha * y[i];                                                                                  \
+    }                                                                                                                    \
+    TARGET void apply(Op op, num* y, const num* x, size_t n) {                                                          \
+        size_t i = 0;                                                                                                    \
+        for (; i + LANES <= n; i += LANES) {                                                                             \
+            REG v = LOAD(y + i), vx = LOAD(x + i);                                                                       \
+            switch (op) {                                                                                                \
+                case Op::Add: v = ADD(v, vx); break;                                                                     \
+                case Op::Sub: v = SUB(v, vx); break;                                                                     \
+                case Op::Mul: v = MUL(v, vx); break;                                                                     \
+                case Op::Div: v = DIV(v, vx); break;                                                                     \
+            }                                                                                                            \
+            STORE(y + i, v);                                                                                             \
+        }                                                                                                                \
+        for (; i < n; i++)                                                                                               \
+            y[i] = compute(op, y[i], x[i]);                                                                              \
+    }                                                                                                                    \
+    TARGET void applyScalar(Op op, num* y, num s, size_t n) {                                                           \
+        REG vs = SET1(s);                                                                                                \
+        size_t i = 0;                                                                                                    \
+        for (; i + LANES <= n; i += LANES) {                                                                             \
+            REG v = LOAD(y + i);                                                                                         \
+            switch (op) {                                                                                                \
+                case Op::Add: v = ADD(v, vs); break;                                                                     \
+                case Op::Sub: v = SUB(v, vs); break;                                                                     \
+                case Op::Mul: v = MUL(v, vs); break;                                                                     \
+                case Op::Div: v = DIV(v, vs); break;                                                                     \
+            }                                                                                                            \
+            STORE(y + i, v);                                                                                             \
+        }                                                                                                                \
+        for (; i < n; i++)                                                                                               \
+            y[i] = compute(op, y[i], s);                                                                                 \
+    }                                                                                                                    \
+    TARGET void spmv(const unsigned* rowStart, const unsigned* cols, const num* values, const num* v, num* out, size_t rows) { \
+        for (size_t r = 0; r < rows; r++) {                                                                              \
+            REG acc = ZERO();                                                                                            \
+            auto k = rowStart[r], end = rowStart[r + 1];                                                                 \
+            for (; k + LANES <= end; k += LANES)                                                                         \
+                acc = ADD(acc, MUL(LOAD(values + k), GATHER(v, cols + k)));                                              \
+            num sum = HSUM(acc);                                                                                         \
+            for (; k < end; k++)                                                                                         \
+                sum += values[k] * v[cols[k]];                                                                           \
+            out[r] = sum;                                                                                                \
+        }                                                                                                                \
+    }                                                                                                                    \
+    constexpr Kernels kernels{dot, axpy, aypx, apply, applyScalar, spmv};                                                \
+    }
+//---------------------------------------------------------------------------
+#define PHYSMAN_SSE2 __attribute__((target("sse2")))
+#define PHYSMAN_AVX2 __attribute__((target("avx2")))
+#define PHYSMAN_AVX512 __attribute__((target("avx512f")))
+#ifdef PHYSMAN_FLOAT
+PHYSMAN_SSE2 inline num hsumSse2(__m128 v) {
+    auto pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+PHYSMAN_SSE2 inline __m128 gatherSse2(const num* v, const unsigned* cols) { return _mm_set_ps(v[cols[3]], v[cols[2]], v[cols[1]], v[cols[0]]); }
+PHYSMAN_SIMD_KERNELS(sse2, PHYSMAN_SSE2, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps, _mm_setzero_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps, hsumSse2, gatherSse2)
+//---------------------------------------------------------------------------
+PHYSMAN_AVX2 inline num hsumAvx2(__m256 v) { return hsumSse2(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1))); }
+/// The masked gathers take a zero source. GCC 12 warns about the undefined one of the unmasked gathers
+PHYSMAN_AVX2 inline __m256 gatherAvx2(const num* v, const unsigned* cols) { return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cols)), _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4); }
+PHYSMAN_SIMD_KERNELS(avx2, PHYSMAN_AVX2, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps, _mm256_setzero_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps, hsumAvx2, gatherAvx2)
+//---------------------------------------------------------------------------
+/// Likewise for the extracts, _mm512_reduce_add_ps extracts from an undefined source
+PHYSMAN_AVX512 inline num hsumAvx512(__m512 v) { return hsumSse2(_mm_add_ps(_mm_add_ps(_mm512_maskz_extractf32x4_ps(0xf, v, 0), _mm512_maskz_extractf32x4_ps(0xf, v, 1)), _mm_add_ps(_mm512_maskz_extractf32x4_ps(0xf, v, 2), _mm512_maskz_extractf32x4_ps(0xf, v, 3)))); }
+PHYSMAN_AVX512 inline __m512 gatherAvx512(const num* v, const unsigned* cols) { return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xffff, _mm512_loadu_si512(cols), v, 4); }
+PHYSMAN_SIMD_KERNELS(avx512, PHYSMAN_AVX512, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps, _mm512_setzero_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_div_ps, hsumAvx512, gatherAvx512)
+#else
+PHYSMAN_SSE2 inline num hsumSse2(__m128d v) { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+PHYSMAN_SSE2 inline __m128d gatherSse2(const num* v, const unsigned* cols) { return _mm_set_pd(v[cols[1]], v[cols[0]]); }
+PHYSMAN_SIMD_KERNELS(sse2, PHYSMAN_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_setzero_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_div_pd, hsumSse2, gatherSse2)
+//---------------------------------------------------------------------------
+PHYSMAN_AVX2 inline num hsumAvx2(__m256d v) { return hsumSse2(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1))); }
+/// The masked gathers take a zero source. GCC 12 warns about the undefined one of the unmasked gathers
+PHYSMAN_AVX2 inline __m256d gatherAvx2(const num* v, const unsigned* cols) { return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(cols)), _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8); }
+PHYSMAN_SIMD_KERNELS(avx2, PHYSMAN_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_setzero_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd, _mm256_div_pd, hsumAvx2, gatherAvx2)
+//---------------------------------------------------------------------------
+/// Likewise for the extracts, _mm512_reduce_add_pd extracts from an undefined source
+PHYSMAN_AVX512 inline num hsumAvx512(__m512d v) { return hsumAvx2(_mm256_add_pd(_mm512_maskz_extractf64x4_pd(0xf, v, 0), _mm512_maskz_extractf64x4_pd(0xf, v, 1))); }
+PHYSMAN_AVX512 inline __m512d gatherAvx512(const num* v, const unsigned* cols) { return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xff, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cols)), v, 8); }
+PHYSMAN_SIMD_KERNELS(avx512, PHYSMAN_AVX512, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd, _mm512_setzero_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd, _mm512_div_pd, hsumAvx512, gatherAvx512)
+#endif
+#undef PHYSMAN_SIMD_KERNELS
+#endif
+//---------------------------------------------------------------------------
+const Kernels* getKernels(Isa isa) {
+#ifdef PHYSMAN_SIMD_X86
+    switch (isa) {
+        case Isa::Scalar: return &scalar::kernels;
+        case Isa::SSE2: return &sse2::kernels;
+        case Isa::AVX2: return &avx2::kernels;
+        case Isa::AVX512: return &avx512::kernels;
+    }
+#endif
+    return &scalar::kernels;
+}
+//---------------------------------------------------------------------------
+/// The selected instruction set and its kernels. Atomic, so that setIsa may run while other threads use the kernels. The kernel tables are constant, relaxed loads are enough
+struct Selection {
+    atomic<Isa> isa;
+    atomic<const Kernels*> kernels;
+};
+//---------------------------------------------------------------------------
+Selection& getSelection()
+// Detect the instruction set on first use instead of in a dynamic initializer, which could run after that of another translation unit using the kernels
+{
+    static Selection selection{detectIsa(), getKernels(detectIsa())};
+    return selection;
+}
+//---------------------------------------------------------------------------
+const Kernels& active() {
+    return *getSelection().kernels.load(memory_order_relaxed);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+Isa detectIsa()
+// Best instruction set supported by this CPU
+{
+#ifdef PHYSMAN_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return Isa::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return Isa::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return Isa::SSE2;
+#endif
+    return Isa::Scalar;
+}
+//---------------------------------------------------------------------------
+Isa getIsa() {
+    return getSelection().isa.load(memory_order_relaxed);
+}
+//---------------------------------------------------------------------------
+bool setIsa(Isa isa)
+// Select the kernels of an instruction set
+{
+    if (isa > detectIsa())
+        return false;
+    auto& selection = getSelection();
+    selection.isa.store(isa, memory_order_relaxed);
+    selection.kernels.store(getKernels(isa), memory_order_relaxed);
+    return true;
+}
+//---------------------------------------------------------------------------
+const char* getName(Isa isa) {
+    switch (isa) {
+        case Isa::Scalar: return "scalar";
+        case Isa::SSE2: return "sse2";
+        case Isa::AVX2: return "avx2";
+        case Isa::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+//---------------------------------------------------------------------------
+num dot(const num* a, const num* b, size_t n) {
+    return active().dot(a, b, n);
+}
+//---------------------------------------------------------------------------
+void axpy(num alpha, const num* x, num* y, size_t n) {
+    active().axpy(alpha, x, y, n);
+}
+//---------------------------------------------------------------------------
+void aypx(num alpha, const num* x, num* y, size_t n) {
+    active().aypx(alpha, x, y, n);
+}
+//---------------------------------------------------------------------------
+void apply(Op op, num* y, const num* x, size_t n) {
+    active().apply(op, y, x, n);
+}
+//---------------------------------------------------------------------------
+void applyScalar(Op op, num* y, num s, size_t n) {
+    active().applyScalar(op, y, s, n);
+}
+//---------------------------------------------------------------------------
+void spmv(const unsigned* rowStart, const unsigned* cols, const num* values, const num* v, num* out, size_t rows) {
+    active().spmv(rowStart, cols, values, v, out, rows);
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Simd") {
+    using Catch::Approx;
+    // Odd sizes exercise the scalar tails
+    Vec a, b;
+    for (unsigned i = 0; i < 37; i++) {
+        a.push_back(i * 0.5 - 3);
+        b.push_back(1.0 / (i + 1));
+    }
+    unsigned rowStart[] = {0, 11, 11, 20};
+    unsigned cols[20];
+    Vec values;
+    for (unsigned k = 0; k < 20; k++) {
+        cols[k] = (k * 7) % 37;
+        values.push_back(k + 1.0);
+    }
+
+    auto previous = getIsa();
+    setIsa(Isa::Scalar);
+    auto expectedDot = dot(a.data(), b.data(), a.size());
+    Vec expectedAxpy = b, expectedAypx = b, expectedDiv = b, expectedMul = b;
+    axpy(2, a.data(), expectedAxpy.data(), a.size());
+    aypx(2, a.data(), expectedAypx.data(), a.size());
+    apply(Op::Div, expectedDiv.data(), a.data(), a.size());
+    applyScalar(Op::Mul, expectedMul.data(), 3, a.size());
+    num expectedSpmv[3];
+    spmv(rowStart, cols, values.data(), a.data(), expectedSpmv, 3);
+
+    for (auto isa : {Isa::SSE2, Isa::AVX2, Isa::AVX512}) {
+        if (!setIsa(isa))
+            continue;
+        REQUIRE(dot(a.data(), b.data(), a.size()) == Approx(expectedDot));
+        Vec y = b;
+        axpy(2, a.data(), y.data(), a.size());
+        for (size_t i = 0; i < y.size(); i++)
+            REQUIRE(y[i] == Approx(expectedAxpy[i]));
+        y = b;
+        aypx(2, a.data(), y.data(), a.size());
+        for (size_t i = 0; i < y.size(); i++)
+            REQUIRE(y[i] == Approx(expectedAypx[i]));
+        y = b;
+        apply(Op::Div, y.data(), a.data(), a.size());
+        for (size_t i = 0; i < y.size(); i++)
+            REQUIRE(y[i] == Approx(expectedDiv[i]));
+        y = b;
+        applyScalar(Op::Mul, y.data(), 3, a.size());
+        for (size_t i = 0; i < y.size(); i++)
+            REQUIRE(y[i] == Approx(expectedMul[i]));
+        num out[3];
+        spmv(rowStart, cols, values.data(), a.data(), out, 3);
+        for (size_t r = 0; r < 3; r++)
+            REQUIRE(out[r] == Approx(expectedSpmv[r]));
+    }
+    setIsa(previous);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
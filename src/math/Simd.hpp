@@ -0,0 +1,46 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "math/Num.hpp"
+#include <cstddef>
+//---------------------------------------------------------------------------
+namespace physman::simd {
+//---------------------------------------------------------------------------
+/// Instruction sets with kernel implementations, ordered by preference
+enum class Isa {
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+/// Elementwise operations of apply and applyScalar
+enum class Op {
+    Add,
+    Sub,
+    Mul,
+    Div
+};
+//---------------------------------------------------------------------------
+/// Best instruction set supported by this CPU
+Isa detectIsa();
+/// Instruction set used by the kernels, detectIsa() by default
+Isa getIsa();
+/// Select the kernels of an instruction set, calls already running finish with the previous ones. Returns false if the CPU does not support it
+bool setIsa(Isa isa);
+/// Name for logs and benchmarks
+const char* getName(Isa isa);
+//---------------------------------------------------------------------------
+/// Sum of a[i] * b[i]
+num dot(const num* a, const num* b, size_t n);
+/// y += alpha * x
+void axpy(num alpha, const num* x, num* y, size_t n);
+/// y = x + alpha * y
+void aypx(num alpha, const num* x, num* y, size_t n);
+/// y = y op x
+void apply(Op op, num* y, const num* x, size_t n);
+/// y = y op s
+void applyScalar(Op op, num* y, num s, size_t n);
+/// Sparse matrix vector product in CSR format, out[r] = sum of values[k] * v[cols[k]] over the entries k of row r
+void spmv(const unsigned* rowStart, const unsigned* cols, const num* values, const num* v, num* out, size_t rows);
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
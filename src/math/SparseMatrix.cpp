@@ -0,0 +1,300 @@
+#include "math/SparseMatrix.hpp"
+#include "math/JobSystem.hpp"
+#include "math/Simd.hpp"
+#include <cassert>
+#include <cmath>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Rows or columns per chunk of the parallel products
+static constexpr size_t productGrain = 1024;
+//---------------------------------------------------------------------------
+void SparseMatrix::resetPattern(size_t cols)
+// Start a new sparsity pattern with the given number of columns
+{
+    numCols = cols;
+    rowStart.assign(1, 0);
+    colIndices.clear();
+    values.clear();
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::addRow(std::span<const unsigned> cols)
+// Append a row with the given columns
+{
+    colIndices.insert(colIndices.end(), cols.begin(), cols.end());
+    rowStart.push_back(static_cast<unsigned>(colIndices.size()));
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::addRows(std::span<const unsigned> cols, unsigned rowLength)
+// Append rows of equal length
+{
+    assert(rowLength > 0 && cols.size() % rowLength == 0);
+    auto base = static_cast<unsigned>(colIndices.size());
+    auto count = cols.size() / rowLength;
+    colIndices.insert(colIndices.end(), cols.begin(), cols.end());
+    rowStart.reserve(rowStart.size() + count);
+    for (size_t i = 1; i <= count; i++)
+        rowStart.push_back(base + static_cast<unsigned>(i * rowLength));
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::finishPattern()
+// Finish the pattern, all values are set to zero
+{
+    values.assign(colIndices.size(), 0);
+    buildTranspose();
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::buildTranspose()
+// Sort the entries by column with a counting sort, entries of a column stay in row order.
+// The entries are placed back to front, which moves the end of each column to its start, so no second array of offsets is needed
+{
+    colStart.assign(numCols + 1, 0);
+    for (auto c : colIndices)
+        colStart[c + 1]++;
+    for (size_t c = 0; c < numCols; c++)
+        colStart[c + 1] += colStart[c];
+    colRows.resize(colIndices.size());
+    colEntries.resize(colIndices.size());
+    for (auto r = rows(); r-- > 0;) {
+        for (auto k = rowStart[r + 1]; k-- > rowStart[r];) {
+            auto pos = --colStart[colIndices[k] + 1];
+            colRows[pos] = static_cast<unsigned>(r);
+            colEntries[pos] = k;
+        }
+    }
+    // colStart[c + 1] is the start of column c now
+    copy(colStart.begin() + 1, colStart.end(), colStart.begin());
+    colStart[numCols] = static_cast<unsigned>(colIndices.size());
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::copyPattern(const SparseMatrix& other)
+// Take over the sparsity pattern of another matrix
+{
+    numCols = other.numCols;
+    rowStart = other.rowStart;
+    colIndices = other.colIndices;
+    colStart = other.colStart;
+    colRows = other.colRows;
+    colEntries = other.colEntries;
+    values.assign(colIndices.size(), 0);
+}
+//---------------------------------------------------------------------------
+Vec SparseMatrix::dot(const Vec& v) const
+// Compute Av
+{
+    Vec result;
+    dot(v, result);
+    return result;
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::dot(std::span<const num> v, Vec& out) const
+// Compute Av into out
+{
+    assert(v.size() == numCols);
+    assert(values.size() == colIndices.size());
+    out.resize(rows());
+    simd::spmv(rowStart.data(), colIndices.data(), values.data(), v.data(), out.data(), rows());
+}
+//---------------------------------------------------------------------------
+Vec SparseMatrix::dotT(const Vec& v) const
+// Compute A^T v
+{
+    Vec result;
+    dotT(v, result);
+    return result;
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::dotT(std::span<const num> v, Vec& out) const
+// Compute A^T v into out
+{
+    assert(v.size() == rows());
+    assert(values.size() == colIndices.size());
+    out.assign(numCols, 0);
+    for (size_t r = 0; r < rows(); r++) {
+        auto vr = v[r];
+        for (auto k = rowStart[r]; k < rowStart[r + 1]; k++)
+            out[colIndices[k]] += values[k] * vr;
+    }
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::dot(std::span<const num> v, Vec& out, JobSystem& jobs) const
+// Compute Av into out, each chunk of rows is independent
+{
+    assert(v.size() == numCols);
+    assert(values.size() == colIndices.size());
+    out.resize(rows());
+    jobs.parallelFor(rows(), productGrain, [&](size_t begin, size_t end) {
+        simd::spmv(rowStart.data() + begin, colIndices.data(), values.data(), v.data(), out.data() + begin, end - begin);
+    });
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::dotT(std::span<const num> v, Vec& out, JobSystem& jobs) const
+// Compute A^T v into out, each column sums its entries in row order like the serial version
+{
+    assert(v.size() == rows());
+    assert(values.size() == colIndices.size());
+    assert(colStart.size() == numCols + 1);
+    out.resize(numCols);
+    jobs.parallelFor(numCols, productGrain, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            num sum = 0;
+            for (auto k = colStart[c]; k < colStart[c + 1]; k++)
+                sum += values[colEntries[k]] * v[colRows[k]];
+            out[c] = sum;
+        }
+    });
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::updateLowValues() {
+    lowValues.resize(values.size());
+    for (size_t k = 0; k < values.size(); k++)
+        lowValues[k] = static_cast<lownum>(values[k]);
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::dotLow(std::span<const num> v, Vec& out) const
+// Compute Av into out, only the stored values have low precision
+{
+    assert(v.size() == numCols);
+    assert(lowValues.size() == colIndices.size());
+    out.resize(rows());
+    for (size_t r = 0; r < rows(); r++) {
+        num sum = 0;
+        for (auto k = rowStart[r]; k < rowStart[r + 1]; k++)
+            sum += static_cast<num>(lowValues[k]) * v[colIndices[k]];
+        out[r] = sum;
+    }
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::dotTLow(std::span<const num> v, Vec& out) const
+// Compute A^T v into out, only the stored values have low precision
+{
+    assert(v.size() == rows());
+    assert(lowValues.size() == colIndices.size());
+    out.assign(numCols, 0);
+    for (size_t r = 0; r < rows(); r++) {
+        auto vr = v[r];
+        for (auto k = rowStart[r]; k < rowStart[r + 1]; k++)
+            out[colIndices[k]] += static_cast<num>(lowValues[k]) * vr;
+    }
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::dotLow(std::span<const num> v, Vec& out, JobSystem& jobs) const
+// Compute Av into out, each chunk of rows is independent
+{
+    assert(v.size() == numCols);
+    assert(lowValues.size() == colIndices.size());
+    out.resize(rows());
+    jobs.parallelFor(rows(), productGrain, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            num sum = 0;
+            for (auto k = rowStart[r]; k < rowStart[r + 1]; k++)
+                sum += static_cast<num>(lowValues[k]) * v[colIndices[k]];
+            out[r] = sum;
+        }
+    });
+}
+//---------------------------------------------------------------------------
+void SparseMatrix::dotTLow(std::span<const num> v, Vec& out, JobSystem& jobs) const
+// Compute A^T v into out, each column sums its entries in row order like the serial version
+{
+    assert(v.size() == rows());
+    assert(lowValues.size() == colIndices.size());
+    assert(colStart.size() == numCols + 1);
+    out.resize(numCols);
+    jobs.parallelFor(numCols, productGrain, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            num sum = 0;
+            for (auto k = colStart[c]; k < colStart[c + 1]; k++)
+                sum += static_cast<num>(lowValues[colEntries[k]]) * v[colRows[k]];
+            out[c] = sum;
+        }
+    });
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/SparseMatrix") {
+    using Catch::Approx;
+    // | 1 0 2 |
+    // | 0 3 0 |
+    SparseMatrix m;
+    m.resetPattern(3);
+    unsigned row0[] = {0, 2};
+    unsigned row1[] = {1};
+    m.addRow(row0);
+    m.addRow(row1);
+    m.finishPattern();
+    REQUIRE(m.rows() == 2);
+    REQUIRE(m.nonZeros() == 3);
+    m.getRowValues(0)[0] = 1;
+    m.getRowValues(0)[1] = 2;
+    m.getRowValues(1)[0] = 3;
+
+    auto d = m.dot({1, 2, 3});
+    REQUIRE(d.size() == 2);
+    REQUIRE(d[0] == Approx(7.0));
+    REQUIRE(d[1] == Approx(6.0));
+    auto dT = m.dotT({1, 2});
+    REQUIRE(dT.size() == 3);
+    REQUIRE(dT[0] == Approx(1.0));
+    REQUIRE(dT[1] == Approx(6.0));
+    REQUIRE(dT[2] == Approx(2.0));
+
+    // Rows of equal length share the pattern
+    SparseMatrix m2;
+    m2.resetPattern(4);
+    unsigned rows[] = {0, 1, 2, 3};
+    m2.addRows(rows, 2);
+    m2.finishPattern();
+    REQUIRE(m2.rows() == 2);
+    REQUIRE(m2.getRowCols(1)[0] == 2);
+    SparseMatrix m3;
+    m3.copyPattern(m2);
+    REQUIRE(m3.rows() == 2);
+    REQUIRE(m3.nonZeros() == 4);
+
+    // The parallel products match the serial ones exactly
+    SparseMatrix big;
+    big.resetPattern(3000);
+    for (unsigned r = 0; r < 5000; r++) {
+        unsigned cols[] = {(r * 7) % 3000, (r * 13 + 1) % 3000, (r * 31 + 2) % 3000};
+        big.addRow(cols);
+    }
+    big.finishPattern();
+    for (size_t k = 0; k < big.values.size(); k++)
+        big.values[k] = std::sin(static_cast<num>(k));
+    Vec x(3000), y(5000);
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = std::cos(static_cast<num>(i));
+    for (size_t i = 0; i < y.size(); i++)
+        y[i] = std::cos(static_cast<num>(2 * i));
+    JobSystem jobs(4);
+    Vec serial, parallel;
+    big.dot(x, serial);
+    big.dot(x, parallel, jobs);
+    REQUIRE(serial == parallel);
+    big.dotT(y, serial);
+    big.dotT(y, parallel, jobs);
+    REQUIRE(serial == parallel);
+
+    // The low precision products are close to the full ones and also independent of the threads
+    big.updateLowValues();
+    Vec full, low;
+    big.dot(x, full);
+    big.dotLow(x, low);
+    for (size_t r = 0; r < full.size(); r++)
+        REQUIRE(low[r] == Approx(full[r]).margin(1e-5));
+    big.dotLow(x, parallel, jobs);
+    REQUIRE(low == parallel);
+    big.dotT(y, full);
+    big.dotTLow(y, low);
+    for (size_t c = 0; c < full.size(); c++)
+        REQUIRE(low[c] == Approx(full[c]).margin(1e-4));
+    big.dotTLow(y, parallel, jobs);
+    REQUIRE(low == parallel);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
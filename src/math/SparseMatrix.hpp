@@ -0,0 +1,89 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "math/Num.hpp"
+#include "math/Vec.hpp"
+#include <span>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+class JobSystem;
+//---------------------------------------------------------------------------
+/// A sparse matrix in compressed sparse row (CSR) format.
+/// Assembly happens in two passes: the sparsity pattern is built first, then the values are written.
+/// The pattern can be kept while only the values change.
+class SparseMatrix {
+    size_t numCols = 0;
+    /// Offset of the first entry of each row, one more entry than rows
+    std::vector<unsigned> rowStart{0};
+    /// Column of each entry
+    std::vector<unsigned> colIndices;
+    /// The pattern in compressed sparse column order, so that A^T v can be computed per column without write conflicts.
+    /// Offset of the first entry of each column, one more entry than columns
+    std::vector<unsigned> colStart{0};
+    /// Row of each entry in column order
+    std::vector<unsigned> colRows;
+    /// Offset into values of each entry in column order
+    std::vector<unsigned> colEntries;
+
+    void buildTranspose();
+
+    public:
+    /// Value of each entry
+    Vec values;
+    /// Low precision copy of values for the mixed precision products, see updateLowValues
+    std::vector<lownum> lowValues;
+
+    SparseMatrix() = default;
+
+    /// Start a new sparsity pattern with the given number of columns
+    void resetPattern(size_t cols);
+    /// Append a row with the given columns
+    void addRow(std::span<const unsigned> cols);
+    /// Append rows of equal length, cols contains rowLength columns per row
+    void addRows(std::span<const unsigned> cols, unsigned rowLength);
+    /// Finish the pattern, all values are set to zero
+    void finishPattern();
+    /// Take over the sparsity pattern of another matrix, all values are set to zero
+    void copyPattern(const SparseMatrix& other);
+
+    size_t rows() const { return rowStart.size() - 1; }
+    size_t cols() const { return numCols; }
+    /// Number of stored entries
+    size_t nonZeros() const { return colIndices.size(); }
+    /// Offset of the first value of a row
+    unsigned getRowStart(size_t row) const { return rowStart[row]; }
+    /// Columns of a row
+    std::span<const unsigned> getRowCols(size_t row) const { return std::span{colIndices}.subspan(rowStart[row], rowStart[row + 1] - rowStart[row]); }
+    /// Values of a row
+    std::span<num> getRowValues(size_t row) { return std::span{values}.subspan(rowStart[row], rowStart[row + 1] - rowStart[row]); }
+    /// Values of a row
+    std::span<const num> getRowValues(size_t row) const { return std::span{values}.subspan(rowStart[row], rowStart[row + 1] - rowStart[row]); }
+
+    /// Compute Av
+    Vec dot(const Vec& v) const;
+    /// Compute Av into out
+    void dot(std::span<const num> v, Vec& out) const;
+    /// Compute A^T v
+    Vec dotT(const Vec& v) const;
+    /// Compute A^T v into out
+    void dotT(std::span<const num> v, Vec& out) const;
+    /// Compute Av into out, the rows are split over the threads
+    void dot(std::span<const num> v, Vec& out, JobSystem& jobs) const;
+    /// Compute A^T v into out, the columns are split over the threads. Gives the same result as the serial version
+    void dotT(std::span<const num> v, Vec& out, JobSystem& jobs) const;
+
+    /// Copy values into lowValues, needed after the values change
+    void updateLowValues();
+    /// Compute Av into out from lowValues, summed in full precision
+    void dotLow(std::span<const num> v, Vec& out) const;
+    /// Compute A^T v into out from lowValues, summed in full precision
+    void dotTLow(std::span<const num> v, Vec& out) const;
+    /// Compute Av into out from lowValues, the rows are split over the threads
+    void dotLow(std::span<const num> v, Vec& out, JobSystem& jobs) const;
+    /// Compute A^T v into out from lowValues, the columns are split over the threads. Gives the same result as the serial version
+    void dotTLow(std::span<const num> v, Vec& out, JobSystem& jobs) const;
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,32 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <chrono>
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Whether the solver collects timings and counters. Without PHYSMAN_STATS the instrumentation compiles to nothing
+#ifdef PHYSMAN_STATS
+inline constexpr bool statsEnabled = true;
+#else
+inline constexpr bool statsEnabled = false;
+#endif
+//---------------------------------------------------------------------------
+/// Adds the time spent in its scope to a counter in seconds
+class ScopedTimer {
+#ifdef PHYSMAN_STATS
+    double& seconds;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    public:
+    explicit ScopedTimer(double& seconds) : seconds(seconds) {}
+    ~ScopedTimer() { seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+#else
+    public:
+    explicit ScopedTimer(double&) {}
+#endif
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,184 @@
+#include "math/Trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+struct Event {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+/// Events of one thread. Only the owning thread writes, head counts all events ever written.
+/// The events are allocated with the first event of a recording and freed when it stops
+struct ThreadBuffer {
+    unsigned id = 0;
+    string name;
+    unique_ptr<Event[]> events;
+    atomic<uint64_t> head{0};
+};
+/// Buffers outlive their threads, so that events of finished threads are still written
+mutex buffersMutex;
+vector<unique_ptr<ThreadBuffer>> buffers;
+thread_local ThreadBuffer* localBuffer = nullptr;
+/// Start of the recording
+atomic<uint64_t> origin{0};
+/// Threads inside record, start and stop wait for them to leave before touching the buffers
+atomic<unsigned> writers{0};
+//---------------------------------------------------------------------------
+ThreadBuffer& getLocalBuffer() {
+    if (!localBuffer) {
+        lock_guard lock(buffersMutex);
+        auto& buffer = buffers.emplace_back(make_unique<ThreadBuffer>());
+        buffer->id = static_cast<unsigned>(buffers.size());
+        buffer->name = fmt::format("thread {}", buffer->id);
+        localBuffer = buffer.get();
+    }
+    return *localBuffer;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+atomic<bool> Trace::enabled{false};
+//---------------------------------------------------------------------------
+void Trace::quiesce()
+// Writers that saw enabled before it was cleared are still counted, the sequentially consistent order guarantees that
+{
+    enabled.store(false);
+    while (writers.load())
+        this_thread::yield();
+}
+//---------------------------------------------------------------------------
+uint64_t Trace::now() {
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+}
+//---------------------------------------------------------------------------
+void Trace::start() {
+    quiesce();
+    lock_guard lock(buffersMutex);
+    for (auto& buffer : buffers)
+        buffer->head.store(0, memory_order_relaxed);
+    origin.store(now(), memory_order_relaxed);
+    enabled.store(true, memory_order_release);
+}
+//---------------------------------------------------------------------------
+void Trace::nameThread(string name) {
+    auto& buffer = getLocalBuffer();
+    lock_guard lock(buffersMutex);
+    buffer.name = std::move(name);
+}
+//---------------------------------------------------------------------------
+void Trace::record(const char* name, uint64_t begin, uint64_t end)
+// Write the slot, then publish it by advancing head
+{
+    writers.fetch_add(1);
+    if (enabled.load()) {
+        auto& buffer = getLocalBuffer();
+        if (!buffer.events)
+            buffer.events = make_unique<Event[]>(capacity);
+        auto head = buffer.head.load(memory_order_relaxed);
+        buffer.events[head % capacity] = {name, begin, end};
+        buffer.head.store(head + 1, memory_order_release);
+    }
+    writers.fetch_sub(1);
+}
+//---------------------------------------------------------------------------
+bool Trace::stop(const string& path)
+// No thread writes events anymore once the writers have left, the buffers are freed after writing
+{
+    quiesce();
+    lock_guard lock(buffersMutex);
+    auto* file = fopen(path.c_str(), "w");
+    if (!file) {
+        for (auto& buffer : buffers)
+            buffer->events.reset();
+        return false;
+    }
+    auto start = origin.load(memory_order_relaxed);
+    auto micros = [&](uint64_t t) { return (static_cast<double>(t) - static_cast<double>(start)) / 1e3; };
+    fmt::print(file, "{{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    bool first = true;
+    for (auto& buffer : buffers) {
+        fmt::print(file, "{}\n{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, \"args\": {{\"name\": \"{}\"}}}}", first ? "" : ",", buffer->id, buffer->name);
+        first = false;
+        if (!buffer->events)
+            continue;
+        auto head = buffer->head.load(memory_order_acquire);
+        for (auto i = head > capacity ? head - capacity : 0; i < head; i++) {
+            auto& event = buffer->events[i % capacity];
+            if (event.begin < start)
+                continue;
+            fmt::print(file, ",\n{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}}}", event.name, buffer->id, micros(event.begin), (event.end - event.begin) / 1e3);
+        }
+        buffer->events.reset();
+    }
+    fmt::print(file, "\n]}}\n");
+    return fclose(file) == 0;
+}
+//---------------------------------------------------------------------------
+TEST_CASE("math/Trace") {
+    auto path = (filesystem::temp_directory_path() / "physman-trace-test.json").string();
+    auto read = [&] {
+        string text;
+        if (auto* file = fopen(path.c_str(), "r")) {
+            char chunk[4096];
+            while (auto n = fread(chunk, 1, sizeof(chunk), file))
+                text.append(chunk, n);
+            fclose(file);
+        }
+        return text;
+    };
+    auto count = [](string_view text, string_view what) {
+        size_t result = 0;
+        for (auto pos = text.find(what); pos != string_view::npos; pos = text.find(what, pos + 1))
+            result++;
+        return result;
+    };
+
+    // Nothing is recorded outside of a recording
+    Trace::record("before", Trace::now(), Trace::now());
+    Trace::start();
+    {
+        TraceScope scope("outer");
+        thread worker([] {
+            Trace::nameThread("trace test worker");
+            TraceScope scope("inner");
+        });
+        worker.join();
+    }
+    // Overflows the ring buffer, only the latest events are kept
+    for (size_t i = 0; i < Trace::capacity + 10; i++)
+        Trace::record("filler", Trace::now(), Trace::now());
+    REQUIRE(Trace::stop(path));
+    {
+        TraceScope scope("after");
+    }
+
+    auto text = read();
+    filesystem::remove(path);
+#ifdef PHYSMAN_STATS
+    REQUIRE(count(text, "\"outer\"") == 0);
+    REQUIRE(count(text, "\"inner\"") == 1);
+    REQUIRE(count(text, "\"trace test worker\"") == 1);
+#endif
+    REQUIRE(text.starts_with("{\"displayTimeUnit\""));
+    REQUIRE(count(text, "\"filler\"") == Trace::capacity);
+    REQUIRE(count(text, "\"before\"") == 0);
+    REQUIRE(count(text, "\"after\"") == 0);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,62 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <string>
+//---------------------------------------------------------------------------
+namespace physman::math {
+//---------------------------------------------------------------------------
+/// Opt-in timeline of named scopes on all threads, written as Chrome trace-event JSON that opens in Perfetto and chrome://tracing.
+/// Every thread records into its own ring buffer without locks, so only the latest events of a long recording are kept.
+/// The ring buffer of a thread is allocated with its first event of a recording, there is no memory held while nothing is recorded.
+/// Part of the PHYSMAN_STATS instrumentation, without it nothing is recorded
+class Trace {
+    static std::atomic<bool> enabled;
+
+    /// Stop recording and wait until no thread is inside record
+    static void quiesce();
+
+    public:
+    /// Events kept per thread
+    static constexpr size_t capacity = size_t(1) << 16;
+
+    /// Start a new recording, drops the events of the previous one
+    static void start();
+    /// Stop recording and write the events to a file. Returns false if the file could not be written
+    static bool stop(const std::string& path);
+    static bool isRecording() { return enabled.load(std::memory_order_relaxed); }
+    /// Name of the calling thread in the timeline
+    static void nameThread(std::string name);
+    /// Nanoseconds of a monotonic clock
+    static uint64_t now();
+    /// Add an event of the calling thread, dropped unless recording. The name must outlive the recording, e.g. a string literal
+    static void record(const char* name, uint64_t begin, uint64_t end);
+};
+//---------------------------------------------------------------------------
+/// Records its scope as one event while a trace is recording
+class TraceScope {
+#ifdef PHYSMAN_STATS
+    const char* name = nullptr;
+    uint64_t begin = 0;
+
+    public:
+    explicit TraceScope(const char* name) {
+        if (Trace::isRecording()) {
+            this->name = name;
+            begin = Trace::now();
+        }
+    }
+    ~TraceScope() {
+        if (name)
+            Trace::record(name, begin, Trace::now());
+    }
+#else
+    public:
+    explicit TraceScope(const char*) {}
+#endif
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -11,6 +11,48 @@ TEST_CASE("math/Val") {
     REQUIRE((x0 * x0).deriveBy(x0).evaluate(bb) == Approx(2 * 2));
     REQUIRE((x0 / x1).deriveBy(x0).evaluate(bb) == Approx(1.0 / 3));
     REQUIRE((x0 / x1).deriveBy(x1).evaluate(bb) == Approx(-2.0 / 9));
+
+    // Simplification
+    static_assert(std::same_as<decltype(x0 * x0), Square<Pos<0>>>);
+    static_assert(std::same_as<decltype(-(-x0)), Pos<0>>);
+    static_assert(std::same_as<decltype(Const{2} * Const{3}), Const>);
+    static_assert(std::same_as<decltype(x0 * x1 + x0 * t), Mul<Pos<0>, Add<Pos<1>, Time>>>);
+    REQUIRE((Const{2} * Const{3} + 1.0).evaluate(bb) == Approx(7));
+    REQUIRE((x0 * x1 + x0 * t).evaluate(bb) == Approx(2 * (3 + 6)));
+
+    // Common subexpressions of a bundle are evaluated once
+    auto d = x0 - x1;
+    auto c = d * d + Sin{d};
+    Bundle bundle{c, c.deriveBy(x0), c.deriveBy(x1)};
+    num out[3];
+    bundle.eval(bb, out);
+    REQUIRE(out[0] == Approx(c.evaluate(bb)));
+    REQUIRE(out[1] == Approx(c.deriveBy(x0).evaluate(bb)));
+    REQUIRE(out[2] == Approx(c.deriveBy(x1).evaluate(bb)));
+    static_assert(decltype(bundle)::numNodes() <= 8);
+
+    // Dual numbers carry the time derivative and the gradient, and on request the gradient of the time derivative
+    std::array<Dual<2, num, true>, 1> dual;
+    Bundle{c}.eval(DualScope<ValScope, 2, true>{bb}, dual);
+    REQUIRE(dual[0].v == Approx(out[0]));
+    REQUIRE(dual[0].grad[0] == Approx(out[1]));
+    REQUIRE(dual[0].grad[1] == Approx(out[2]));
+    REQUIRE(dual[0].dt == Approx(c.deriveBy(t).evaluate(bb)));
+    REQUIRE(dual[0].gradDt[0] == Approx(c.deriveBy(t).deriveBy(x0).evaluate(bb)));
+    REQUIRE(dual[0].gradDt[1] == Approx(c.deriveBy(t).deriveBy(x1).evaluate(bb)));
+    // Quotients and reciprocals, against central differences of the time derivative
+    auto q = Sin{x0} / (x0 * x1) + Cos{x1} / x0;
+    Bundle{q}.eval(DualScope<ValScope, 2, true>{bb}, dual);
+    for (unsigned i = 0; i < 2; i++) {
+        std::array<Dual<2, num, true>, 1> above, below;
+        auto shifted = bb;
+        num h = 1e-3;
+        shifted.xs[i] = bb.xs[i] + h;
+        Bundle{q}.eval(DualScope<ValScope, 2, true>{shifted}, above);
+        shifted.xs[i] = bb.xs[i] - h;
+        Bundle{q}.eval(DualScope<ValScope, 2, true>{shifted}, below);
+        REQUIRE(dual[0].gradDt[i] == Approx((above[0].dt - below[0].dt) / (2 * h)).epsilon(1e-3));
+    }
 }
 //---------------------------------------------------------------------------
 }
\ No newline at end of file
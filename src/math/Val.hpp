@@ -1,8 +1,11 @@
 #pragma once
 //---------------------------------------------------------------------------
+#include "math/Dual.hpp"
 #include "math/Num.hpp"
+#include "math/Pack.hpp"
 #include "math/Vec.hpp"
 #include <array>
+#include <cassert>
 #include <cmath>
 #include <span>
 #include <tuple>
@@ -26,30 +29,115 @@ struct ValScope {
     static auto make(Vec xs, Vec vs, Vec ps, num t);
 };
 //---------------------------------------------------------------------------
+/// Scope for many instances of the same expression in structure of arrays layout.
+/// Value id of instance i is at [id * count + i]
+struct BatchScope {
+    const num* xs = nullptr;
+    const num* vs = nullptr;
+    const num* ps = nullptr;
+    num t = 0;
+    size_t count = 0;
+
+    /// Scope of a single instance
+    struct Instance {
+        const BatchScope& batch;
+        size_t i;
+        constexpr num getPos(unsigned id) const { return batch.xs[id * batch.count + i]; }
+        constexpr num getVel(unsigned id) const { return batch.vs[id * batch.count + i]; }
+        constexpr num getParam(unsigned id) const { return batch.ps[id * batch.count + i]; }
+        constexpr num getTime() const { return batch.t; }
+    };
+    constexpr Instance operator[](size_t i) const { return {*this, i}; }
+
+    /// Scope of the instances [first, first + W), evaluates to packs
+    template <unsigned W>
+    struct Lanes {
+        const BatchScope& batch;
+        size_t first;
+        constexpr Pack<W> getPos(unsigned id) const { return Pack<W>::load(batch.xs + id * batch.count + first); }
+        constexpr Pack<W> getVel(unsigned id) const { return Pack<W>::load(batch.vs + id * batch.count + first); }
+        constexpr Pack<W> getParam(unsigned id) const { return Pack<W>::load(batch.ps + id * batch.count + first); }
+        constexpr Pack<W> getTime() const { return Pack<W>{batch.t}; }
+    };
+    template <unsigned W>
+    constexpr Lanes<W> lanes(size_t first) const {
+        assert(first + W <= count);
+        return {*this, first};
+    }
+};
+//---------------------------------------------------------------------------
+/// Scope of a single instance that refers to the full state through component indices instead of copying it
+struct IndexedScope {
+    std::span<const num> xs;
+    std::span<const num> vs;
+    std::span<const unsigned> components;
+    std::span<const num> ps;
+    num t = 0;
+    constexpr num getPos(unsigned id) const { return xs[components[id]]; }
+    constexpr num getVel(unsigned id) const { return vs[components[id]]; }
+    constexpr num getParam(unsigned id) const { return ps[id]; }
+    constexpr num getTime() const { return t; }
+};
+//---------------------------------------------------------------------------
+/// Scope that evaluates to dual numbers, so that a single evaluation yields the value, the time derivative and the gradient with respect to the N positions.
+/// With TimeGradient also the gradient of the time derivative
+template <typename S, unsigned N, bool TimeGradient = false>
+struct DualScope {
+    /// num, or a Pack for scopes of several instances
+    using T = decltype(std::declval<const S&>().getPos(0));
+    using D = Dual<N, T, TimeGradient>;
+    const S& scope;
+    constexpr D getPos(unsigned id) const {
+        D result{scope.getPos(id), scope.getVel(id)};
+        result.grad[id] = T{1};
+        return result;
+    }
+    constexpr D getVel(unsigned id) const { return {scope.getVel(id)}; }
+    constexpr D getParam(unsigned id) const { return {scope.getParam(id)}; }
+    constexpr D getTime() const { return {scope.getTime(), T{1}}; }
+};
+//---------------------------------------------------------------------------
 namespace val {
 //---------------------------------------------------------------------------
 struct Val {
+    /// Evaluate for a single scope
     constexpr virtual num evaluate(const ValScope&) const = 0;
+    // Every node also has a non-virtual eval(const S&) for any scope type S that provides getPos, getVel, getParam and getTime
     template <typename T>
     static constexpr unsigned numComponents();
     template <typename T>
     static constexpr unsigned numParams();
+    /// Whether all nodes of type T have the same value, i.e. T stores no runtime constants
+    template <typename T>
+    static constexpr bool isStateless();
 };
 //---------------------------------------------------------------------------
+/// Evaluate a child node. Scopes that cache common subexpressions return the cached value instead
+template <typename T>
+constexpr auto evalNode(const T& node, const auto& s) {
+    if constexpr (requires { s.template getCached<T>(); })
+        return s.template getCached<T>();
+    else
+        return node.eval(s);
+}
+//---------------------------------------------------------------------------
 struct Zero final : Val {
     num evaluate(const ValScope&) const final { return 0; }
+    static constexpr num eval(const auto&) { return 0; }
     constexpr auto deriveBy(auto) const { return Zero{}; }
     static constexpr void visit(auto f) { f(std::type_identity<Zero>{}); }
 };
 //---------------------------------------------------------------------------
 struct One final : Val {
     num evaluate(const ValScope&) const final { return 1; }
+    static constexpr num eval(const auto&) { return 1; }
     constexpr auto deriveBy(auto) const { return Zero{}; }
     static constexpr void visit(auto f) { f(std::type_identity<One>{}); }
 };
 //---------------------------------------------------------------------------
 struct Time final : Val {
     num evaluate(const ValScope& vs) const final { return vs.getTime(); }
+    static constexpr auto eval(const auto& s) { return s.getTime(); }
     constexpr auto deriveBy(Time) const { return One{}; }
     constexpr auto deriveBy(auto) const { return Zero{}; }
     static constexpr void visit(auto f) { f(std::type_identity<Time>{}); }
@@ -59,6 +147,7 @@ struct Const final : Val {
     num c;
     constexpr Const(num c) : c(c) {}
     constexpr num evaluate(const ValScope&) const final { return c; }
+    constexpr num eval(const auto&) const { return c; }
     constexpr auto deriveBy(auto) const { return Zero{}; }
     static constexpr void visit(auto f) { f(std::type_identity<Const>{}); }
 };
@@ -67,6 +156,7 @@ template <unsigned Id>
 struct Param final : Val {
     static constexpr unsigned getParamId() { return Id; }
     constexpr num evaluate(const ValScope& vs) const final { return vs.getParam(Id); }
+    static constexpr auto eval(const auto& s) { return s.getParam(Id); }
 
     constexpr auto deriveBy(Param) const { return One{}; }
     constexpr auto deriveBy(auto) const { return Zero{}; }
@@ -77,6 +167,7 @@ template <unsigned Id>
 struct Vel final : Val {
     static constexpr unsigned getComponentId() { return Id; }
     constexpr num evaluate(const ValScope& vs) const final { return vs.getVel(Id); }
+    static constexpr auto eval(const auto& s) { return s.getVel(Id); }
 
     constexpr auto deriveBy(Vel) const { return One{}; }
     constexpr auto deriveBy(auto) const { return Zero{}; }
@@ -87,6 +178,7 @@ template <unsigned Id>
 struct Pos final : Val {
     static constexpr unsigned getComponentId() { return Id; }
     constexpr num evaluate(const ValScope& vs) const final { return vs.getPos(Id); }
+    static constexpr auto eval(const auto& s) { return s.getPos(Id); }
 
     constexpr auto deriveBy(Time) const { return Vel<Id>{}; }
     constexpr auto deriveBy(Pos) const { return One{}; }
@@ -98,9 +190,12 @@ template <std::derived_from<Val> A, std::derived_from<Val> B>
 struct Add : Val {
     [[no_unique_address]] A a;
     [[no_unique_address]] B b;
+    constexpr Add() = default;
     constexpr Add(A a, B b) : a(a), b(b) {}
-    constexpr num evaluate(const ValScope& vs) const final { return a.evaluate(vs) + b.evaluate(vs); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { return evalNode(a, s) + evalNode(b, s); }
     constexpr auto deriveBy(auto v) const { return a.deriveBy(v) + b.deriveBy(v); }
+    constexpr auto children() const { return std::tie(a, b); }
     static constexpr void visit(auto f) { f(std::type_identity<Add>{}); A::visit(f); B::visit(f); }
 };
 //---------------------------------------------------------------------------
@@ -108,18 +203,24 @@ template <std::derived_from<Val> A, std::derived_from<Val> B>
 struct Sub : Val {
     [[no_unique_address]] A a;
     [[no_unique_address]] B b;
+    constexpr Sub() = default;
     constexpr Sub(A a, B b) : a(a), b(b) {}
-    constexpr num evaluate(const ValScope& vs) const final { return a.evaluate(vs) - b.evaluate(vs); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { return evalNode(a, s) - evalNode(b, s); }
     constexpr auto deriveBy(auto v) const { return a.deriveBy(v) - b.deriveBy(v); }
+    constexpr auto children() const { return std::tie(a, b); }
     static constexpr void visit(auto f) { f(std::type_identity<Sub>{}); A::visit(f); B::visit(f); }
 };
 //---------------------------------------------------------------------------
 template <std::derived_from<Val> A>
 struct Neg : Val {
     [[no_unique_address]] A a;
+    constexpr Neg() = default;
     constexpr Neg(A a) : a(a) {}
-    constexpr num evaluate(const ValScope& vs) const final { return -a.evaluate(vs); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { return -evalNode(a, s); }
     constexpr auto deriveBy(auto v) const { return -a.deriveBy(v); }
+    constexpr auto children() const { return std::tie(a); }
     static constexpr void visit(auto f) { f(std::type_identity<Neg>{}); A::visit(f); }
 };
 //---------------------------------------------------------------------------
@@ -127,18 +228,36 @@ template <std::derived_from<Val> A, std::derived_from<Val> B>
 struct Mul : Val {
     [[no_unique_address]] A a;
     [[no_unique_address]] B b;
+    constexpr Mul() = default;
     constexpr Mul(A a, B b) : a(a), b(b) {}
-    constexpr num evaluate(const ValScope& vs) const final { return a.evaluate(vs) * b.evaluate(vs); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { return evalNode(a, s) * evalNode(b, s); }
     constexpr auto deriveBy(auto v) const { return a.deriveBy(v) * b + a * b.deriveBy(v); }
+    constexpr auto children() const { return std::tie(a, b); }
     static constexpr void visit(auto f) { f(std::type_identity<Mul>{}); A::visit(f); B::visit(f); }
 };
 //---------------------------------------------------------------------------
 template <std::derived_from<Val> A>
+struct Square : Val {
+    [[no_unique_address]] A a;
+    constexpr Square() = default;
+    constexpr Square(A a) : a(a) {}
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { auto v = evalNode(a, s); return v * v; }
+    constexpr auto deriveBy(auto v) const;
+    constexpr auto children() const { return std::tie(a); }
+    static constexpr void visit(auto f) { f(std::type_identity<Square>{}); A::visit(f); }
+};
+//---------------------------------------------------------------------------
+template <std::derived_from<Val> A>
 struct Recip : Val {
     [[no_unique_address]] A a;
+    constexpr Recip() = default;
     constexpr Recip(A a) : a(a) {}
-    constexpr num evaluate(const ValScope& vs) const final { return 1.0 / a.evaluate(vs); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { return num{1} / evalNode(a, s); }
     constexpr auto deriveBy(auto v) const { return -(a.deriveBy(v) * Recip<decltype(a * a)>{a * a}); }
+    constexpr auto children() const { return std::tie(a); }
     static constexpr void visit(auto f) { f(std::type_identity<Recip>{}); A::visit(f); }
 };
 //---------------------------------------------------------------------------
@@ -146,35 +265,47 @@ template <std::derived_from<Val> A, std::derived_from<Val> B>
 struct Div : Val {
     [[no_unique_address]] A a;
     [[no_unique_address]] B b;
+    constexpr Div() = default;
     constexpr Div(A a, B b) : a(a), b(b) {}
-    constexpr num evaluate(const ValScope& vs) const final { return a.evaluate(vs) / b.evaluate(vs); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { return evalNode(a, s) / evalNode(b, s); }
     constexpr auto deriveBy(auto v) const { return (a * Recip{b}).deriveBy(v); }
+    constexpr auto children() const { return std::tie(a, b); }
     static constexpr void visit(auto f) { f(std::type_identity<Div>{}); A::visit(f); B::visit(f); }
 };
 //---------------------------------------------------------------------------
 template <std::derived_from<Val> A>
 struct Sin : Val {
     [[no_unique_address]] A a;
+    constexpr Sin() = default;
     constexpr Sin(A a) : a(a) {}
-    constexpr num evaluate(const ValScope& vs) const final { return std::sin(a.evaluate(vs)); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { using std::sin; return sin(evalNode(a, s)); }
     constexpr auto deriveBy(auto v) const;
+    constexpr auto children() const { return std::tie(a); }
     static constexpr void visit(auto f) { f(std::type_identity<Sin>{}); A::visit(f); }
 };
 //---------------------------------------------------------------------------
 template <std::derived_from<Val> A>
 struct Cos : Val {
     [[no_unique_address]] A a;
+    constexpr Cos() = default;
     constexpr Cos(A a) : a(a) {}
-    constexpr num evaluate(const ValScope& vs) const final { return std::cos(a.evaluate(vs)); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const { using std::cos; return cos(evalNode(a, s)); }
     constexpr auto deriveBy(auto v) const;
+    constexpr auto children() const { return std::tie(a); }
     static constexpr void visit(auto f) { f(std::type_identity<Cos>{}); A::visit(f); }
 };
 //---------------------------------------------------------------------------
 template <std::derived_from<Val> A>
-constexpr auto Sin<A>::deriveBy(auto) const { return Cos{a}; }
+constexpr auto Sin<A>::deriveBy(auto v) const { return a.deriveBy(v) * Cos{a}; }
+//---------------------------------------------------------------------------
+template <std::derived_from<Val> A>
+constexpr auto Cos<A>::deriveBy(auto v) const { return -(a.deriveBy(v) * Sin{a}); }
 //---------------------------------------------------------------------------
 template <std::derived_from<Val> A>
-constexpr auto Cos<A>::deriveBy(auto) const { return -Sin{a}; }
+constexpr auto Square<A>::deriveBy(auto v) const { return Const{2} * (a * a.deriveBy(v)); }
 //---------------------------------------------------------------------------
 template <std::derived_from<Val> X, std::derived_from<Val> Y, std::derived_from<Val> Z>
 struct Vec3 {
@@ -192,11 +323,23 @@ struct If : Val {
     [[no_unique_address]] A a;
     [[no_unique_address]] B b;
     [[no_unique_address]] C c;
+    constexpr If() = default;
     constexpr If(Cond cond, A a, B b, C c) : a(a), b(b), c(c) {}
-    constexpr num evaluate(const ValScope& vs) const final { return cond(a.evaluate(vs)) ? b.evaluate(vs) : c.evaluate(vs); }
+    constexpr num evaluate(const ValScope& vs) const final { return eval(vs); }
+    constexpr auto eval(const auto& s) const {
+        auto condValue = value(evalNode(a, s));
+        if constexpr (std::is_arithmetic_v<decltype(condValue)>) {
+            return cond(condValue) ? evalNode(b, s) : evalNode(c, s);
+        } else {
+            // Packs evaluate both sides and blend them with a lane mask
+            using R = decltype(evalNode(b, s) + evalNode(c, s));
+            return select(makeMask(condValue, cond), R(evalNode(b, s)), R(evalNode(c, s)));
+        }
+    }
     constexpr auto deriveBy(auto v) {
         return If<Cond, A, decltype(b.deriveBy(v)), decltype(c.deriveBy(v))>{cond, a, b.deriveBy(v), c.deriveBy(v)};
     }
+    constexpr auto children() const { return std::tie(a, b, c); }
     static constexpr void visit(auto f) { f(std::type_identity<If>{}); A::visit(f); B::visit(f); C::visit(f); }
 };
 //---------------------------------------------------------------------------
@@ -224,6 +367,28 @@ constexpr unsigned Val::numParams()
     return result;
 }
 //---------------------------------------------------------------------------
+template <typename T>
+constexpr bool Val::isStateless()
+// Whether T stores no runtime constants
+{
+    if constexpr (std::same_as<T, Const>) {
+        return false;
+    } else if constexpr (requires(const T& t) { t.children(); }) {
+        // Also rules out conditions that capture state
+        if (!std::is_default_constructible_v<T>)
+            return false;
+        return []<typename... Cs>(std::type_identity<std::tuple<Cs...>>) {
+            return (isStateless<std::remove_cvref_t<Cs>>() && ...);
+        }(std::type_identity<decltype(std::declval<const T&>().children())>{});
+    } else {
+        return true;
+    }
+}
+//---------------------------------------------------------------------------
+/// Nodes of equal type are interchangeable
+template <typename T>
+concept Stateless = std::derived_from<T, Val> && Val::isStateless<T>();
+//---------------------------------------------------------------------------
 constexpr auto operator-(Zero) { return Zero{}; }
 constexpr auto operator-(Zero, Zero) { return Zero{}; }
 constexpr auto operator+(Zero, Zero) { return Zero{}; }
@@ -232,6 +397,29 @@ constexpr auto operator+(Zero, One) { return One{}; }
 constexpr auto operator-(One, Zero) { return One{}; }
 constexpr auto operator+(One, Zero) { return One{}; }
 constexpr auto operator-(One, One) { return Zero{}; }
+constexpr auto operator*(Zero, Zero) { return Zero{}; }
+constexpr auto operator*(Zero, One) { return Zero{}; }
+constexpr auto operator*(One, Zero) { return Zero{}; }
+constexpr auto operator*(One, One) { return One{}; }
+// Constant folding
+constexpr auto operator-(Const a) { return Const{-a.c}; }
+constexpr auto operator+(Const a, Const b) { return Const{a.c + b.c}; }
+constexpr auto operator-(Const a, Const b) { return Const{a.c - b.c}; }
+constexpr auto operator*(Const a, Const b) { return Const{a.c * b.c}; }
+constexpr auto operator/(Const a, Const b) { return Const{a.c / b.c}; }
+constexpr auto operator+(Const a, num b) { return Const{a.c + b}; }
+constexpr auto operator-(Const a, num b) { return Const{a.c - b}; }
+constexpr auto operator*(Const a, num b) { return Const{a.c * b}; }
+constexpr auto operator/(Const a, num b) { return Const{a.c / b}; }
+constexpr auto operator+(num a, Const b) { return Const{a + b.c}; }
+constexpr auto operator-(num a, Const b) { return Const{a - b.c}; }
+constexpr auto operator*(num a, Const b) { return Const{a * b.c}; }
+constexpr auto operator/(num a, Const b) { return Const{a / b.c}; }
+// Algebraic simplification, only for stateless nodes since equal types must mean equal values
+template <std::derived_from<Val> A> constexpr auto operator-(Neg<A> a) { return a.a; }
+template <Stateless A> constexpr auto operator*(A a, A) { return Square{a}; }
+template <Stateless A, std::derived_from<Val> B, std::derived_from<Val> C> constexpr auto operator+(Mul<A, B> x, Mul<A, C> y) { return x.a * (x.b + y.b); }
+template <Stateless A, std::derived_from<Val> B, std::derived_from<Val> C> constexpr auto operator-(Mul<A, B> x, Mul<A, C> y) { return x.a * (x.b - y.b); }
 template <std::derived_from<Val> A> constexpr auto operator-(A a) { return Neg{a}; }
 template <std::derived_from<Val> A> constexpr auto operator+(A a, Zero) { return a; }
 template <std::derived_from<Val> A> constexpr auto operator+(Zero, A a) { return a; }
@@ -265,6 +453,91 @@ constexpr auto operator*(Vec3<X1, Y1, Z1> v1, Vec3<X2, Y2, Z2> v2) { return Vec3
 template <std::derived_from<Val> X1, std::derived_from<Val> Y1, std::derived_from<Val> Z1, std::derived_from<Val> X2, std::derived_from<Val> Y2, std::derived_from<Val> Z2>
 constexpr auto operator/(Vec3<X1, Y1, Z1> v1, Vec3<X2, Y2, Z2> v2) { return Vec3{v1.x / v2.x, v1.y / v2.y, v1.z / v2.z}; }
 //---------------------------------------------------------------------------
+namespace cse {
+template <typename... Ts>
+struct List {};
+/// Append T to a list unless it is already contained
+template <typename L, typename T>
+struct AddUnique;
+template <typename... Ts, typename T>
+struct AddUnique<List<Ts...>, T> {
+    using type = std::conditional_t<(std::same_as<T, Ts> || ...), List<Ts...>, List<Ts..., T>>;
+};
+template <typename L, typename Children>
+struct CollectChildren;
+/// Append the stateless inner nodes of T to L, children before their parents
+template <typename L, typename T>
+struct Collect {
+    using type = L;
+};
+template <typename L, typename T>
+    requires requires(const T& t) { t.children(); }
+struct Collect<L, T> {
+    using WithChildren = typename CollectChildren<L, decltype(std::declval<const T&>().children())>::type;
+    using type = std::conditional_t<Val::isStateless<T>(), typename AddUnique<WithChildren, T>::type, WithChildren>;
+};
+template <typename L>
+struct CollectChildren<L, std::tuple<>> {
+    using type = L;
+};
+template <typename L, typename C, typename... Cs>
+struct CollectChildren<L, std::tuple<C, Cs...>> {
+    using type = typename CollectChildren<typename Collect<L, std::remove_cvref_t<C>>::type, std::tuple<Cs...>>::type;
+};
+template <typename T, typename... Ts>
+constexpr size_t indexOf() {
+    size_t result = 0;
+    ((std::same_as<T, Ts> || (++result, false)) || ...);
+    return result;
+}
+}
+//---------------------------------------------------------------------------
+/// Scope that returns precomputed values for the subexpressions Nodes
+template <typename S, typename... Nodes>
+struct CachedScope {
+    using Value = decltype(std::declval<const S&>().getPos(0));
+    const S& scope;
+    std::array<Value, sizeof...(Nodes)> values{};
+    constexpr auto getPos(unsigned id) const { return scope.getPos(id); }
+    constexpr auto getVel(unsigned id) const { return scope.getVel(id); }
+    constexpr auto getParam(unsigned id) const { return scope.getParam(id); }
+    constexpr auto getTime() const { return scope.getTime(); }
+    template <typename T>
+        requires(std::same_as<T, Nodes> || ...)
+    constexpr const Value& getCached() const { return values[cse::indexOf<T, Nodes...>()]; }
+};
+//---------------------------------------------------------------------------
+/// Several expressions that are evaluated together. Every distinct stateless subexpression is evaluated only once
+template <std::derived_from<Val>... Roots>
+class Bundle {
+    using Nodes = typename cse::CollectChildren<cse::List<>, std::tuple<Roots...>>::type;
+    std::tuple<Roots...> roots;
+
+    public:
+    static constexpr size_t size = sizeof...(Roots);
+
+    constexpr Bundle(Roots... roots) : roots(roots...) {}
+
+    /// Number of distinct subexpressions that are evaluated once
+    static constexpr size_t numNodes() {
+        return []<typename... Ns>(cse::List<Ns...>) { return sizeof...(Ns); }(Nodes{});
+    }
+    /// Evaluate all expressions into out[0] to out[size - 1]
+    template <typename S>
+    constexpr void eval(const S& s, auto&& out) const {
+        [&]<typename... Ns>(cse::List<Ns...>) {
+            CachedScope<S, Ns...> cached{s};
+            [&]<size_t... Is>(std::index_sequence<Is...>) {
+                // Stateless nodes are default constructible and interchangeable
+                ((cached.values[Is] = Ns{}.eval(cached)), ...);
+            }(std::index_sequence_for<Ns...>{});
+            [&]<size_t... Is>(std::index_sequence<Is...>) {
+                ((out[Is] = evalNode(std::get<Is>(roots), cached)), ...);
+            }(std::index_sequence_for<Roots...>{});
+        }(Nodes{});
+    }
+};
+//---------------------------------------------------------------------------
 }
 //---------------------------------------------------------------------------
 template <size_t Components>
@@ -1,46 +1,122 @@
 #pragma once
 //---------------------------------------------------------------------------
 #include "math/Num.hpp"
-#include <numeric>
+#include "math/Simd.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <concepts>
 #include <functional>
+#include <numeric>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 //---------------------------------------------------------------------------
 namespace physman {
 //---------------------------------------------------------------------------
+class Vec;
+template <typename Op, typename... Args>
+class VecMap;
+//---------------------------------------------------------------------------
+template <typename T>
+inline constexpr bool isVecMap = false;
+template <typename Op, typename... Args>
+inline constexpr bool isVecMap<VecMap<Op, Args...>> = true;
+/// A lazy elementwise expression
+template <typename T>
+concept VecExpression = isVecMap<std::remove_cvref_t<T>>;
+/// A Vec or a lazy expression
+template <typename T>
+concept VecLike = VecExpression<T> || std::same_as<std::remove_cvref_t<T>, Vec>;
+/// Anything that can appear in an elementwise expression, scalars are broadcast
+template <typename T>
+concept VecOperand = VecLike<T> || std::is_arithmetic_v<std::remove_cvref_t<T>>;
+//---------------------------------------------------------------------------
+namespace vecdetail {
+inline num getAt(const auto& v, size_t index) {
+    if constexpr (std::is_arithmetic_v<std::remove_cvref_t<decltype(v)>>)
+        return v;
+    else
+        return v[index];
+}
+/// Size of an operand, 0 for scalars
+inline size_t getSize(const auto& v) {
+    if constexpr (std::is_arithmetic_v<std::remove_cvref_t<decltype(v)>>)
+        return 0;
+    else
+        return v.size();
+}
+/// The SIMD kernel of a standard operator
+template <typename Op>
+constexpr std::optional<simd::Op> getSimdOp() {
+    if constexpr (std::same_as<Op, std::plus<>>)
+        return simd::Op::Add;
+    else if constexpr (std::same_as<Op, std::minus<>>)
+        return simd::Op::Sub;
+    else if constexpr (std::same_as<Op, std::multiplies<>>)
+        return simd::Op::Mul;
+    else if constexpr (std::same_as<Op, std::divides<>>)
+        return simd::Op::Div;
+    else
+        return std::nullopt;
+}
+/// Lvalue Vecs are referenced, temporaries and expressions are stored by value
+template <typename T>
+using Store = std::conditional_t<std::is_lvalue_reference_v<T> && std::same_as<std::remove_cvref_t<T>, Vec>, const Vec&, std::conditional_t<std::is_arithmetic_v<std::remove_cvref_t<T>>, num, std::remove_cvref_t<T>>>;
+}
+//---------------------------------------------------------------------------
 class Vec : public std::vector<num> {
-    static num getAt(const Vec& v, size_t index) { return v[index]; }
-    static num getAt(num v, size_t) { return v; }
-
-    Vec& applyImpl(auto&& op) {
+    Vec& applyImpl(auto&& op, const auto& v) {
+        assert(vecdetail::getSize(v) == 0 || vecdetail::getSize(v) == size());
+        // Plain operations on stored values go through the SIMD kernels
+        constexpr auto simdOp = vecdetail::getSimdOp<std::remove_cvref_t<decltype(op)>>();
+        if constexpr (simdOp.has_value() && std::same_as<std::remove_cvref_t<decltype(v)>, Vec>) {
+            simd::apply(*simdOp, data(), v.data(), size());
+            return *this;
+        } else if constexpr (simdOp.has_value() && std::is_arithmetic_v<std::remove_cvref_t<decltype(v)>>) {
+            simd::applyScalar(*simdOp, data(), v, size());
+            return *this;
+        }
         for (size_t i = 0; i < size(); i++)
-            operator[](i) = op(operator[](i));
+            operator[](i) = op(operator[](i), vecdetail::getAt(v, i));
         return *this;
     }
-    Vec& applyImpl(auto&& op, auto&& v) {
+
+    public:
+    using std::vector<num>::vector;
+    using std::vector<num>::push_back;
+
+    Vec() = default;
+    /// Evaluate an expression in a single loop. Only temporary expressions convert, an expression kept in a variable needs std::move, see VecMap
+    template <VecExpression E> requires(!std::is_lvalue_reference_v<E>)
+    Vec(E&& e) : std::vector<num>(e.size()) {
         for (size_t i = 0; i < size(); i++)
-            operator[](i) = op(operator[](i), getAt(v, i));
-        return *this;
+            operator[](i) = e[i];
     }
-    Vec& applyImplRev(auto&& op, auto&& v) {
+    /// Evaluate an expression in a single loop. The expression may reference this Vec
+    template <VecExpression E> requires(!std::is_lvalue_reference_v<E>)
+    Vec& operator=(E&& e) {
+        resize(e.size());
         for (size_t i = 0; i < size(); i++)
-            operator[](i) = op(getAt(v, i), operator[](i));
+            operator[](i) = e[i];
         return *this;
     }
 
-    public:
-    using std::vector<num>::vector;
-    using std::vector<num>::push_back;
-
-    Vec& operator+=(const Vec& v) { return applyImpl(std::plus{}, v); }
-    Vec& operator-=(const Vec& v) { return applyImpl(std::minus{}, v); }
-    Vec& operator*=(const Vec& v) { return applyImpl(std::multiplies{}, v); }
-    Vec& operator/=(const Vec& v) { return applyImpl(std::divides{}, v); }
-    Vec& operator+=(num v) { return applyImpl(std::plus{}, v); }
-    Vec& operator-=(num v) { return applyImpl(std::minus{}, v); }
-    Vec& operator*=(num v) { return applyImpl(std::multiplies{}, v); }
-    Vec& operator/=(num v) { return applyImpl(std::divides{}, v); }
-    Vec& negate() { return applyImpl(std::negate{}); }
+    template <VecOperand T>
+    Vec& operator+=(const T& v) { return applyImpl(std::plus{}, v); }
+    template <VecOperand T>
+    Vec& operator-=(const T& v) { return applyImpl(std::minus{}, v); }
+    template <VecOperand T>
+    Vec& operator*=(const T& v) { return applyImpl(std::multiplies{}, v); }
+    template <VecOperand T>
+    Vec& operator/=(const T& v) { return applyImpl(std::divides{}, v); }
+    Vec& negate() {
+        for (auto& v : *this)
+            v = -v;
+        return *this;
+    }
 
     Vec slice(size_t start, size_t count) const {
         return Vec(std::vector<num>::begin() + start, std::vector<num>::begin() + start + count);
@@ -56,38 +132,87 @@ class Vec : public std::vector<num> {
 
     num sum() const { return std::accumulate(begin(), end(), num{0}); }
 
-    static Vec apply(auto&& op, Vec&& v1) { return std::move(v1.applyImpl(op)); }
-    static Vec apply(auto&& op, const Vec& v1) { return std::move(Vec{v1}.applyImpl(op)); }
-    static Vec apply(auto&& op, Vec&& v1, Vec&& v2) { return std::move(v1.applyImpl(op, v2)); }
-    static Vec apply(auto&& op, Vec&& v1, const Vec& v2) { return std::move(v1.applyImpl(op, v2)); }
-    static Vec apply(auto&& op, const Vec& v1, Vec&& v2) { return std::move(v2.applyImplRev(op, v1)); }
-    static Vec apply(auto&& op, const Vec& v1, const Vec& v2) { return std::move(Vec{v1}.applyImpl(op, v2)); }
-    static Vec apply(auto&& op, Vec&& v1, num v2) { return std::move(v1.applyImpl(op, v2)); }
-    static Vec apply(auto&& op, const Vec& v1, num v2) { return std::move(Vec{v1}.applyImpl(op, v2)); }
-    static Vec apply(auto&& op, num v2, Vec&& v1) { return std::move(v1.applyImplRev(op, v2)); }
-    static Vec apply(auto&& op, num v2, const Vec& v1) { return std::move(Vec{v1}.applyImplRev(op, v2)); }
+    /// Lazily apply op elementwise
+    template <typename Op, VecOperand... Args>
+    static auto apply(Op op, Args&&... args) { return VecMap<Op, vecdetail::Store<Args&&>...>(op, std::forward<Args>(args)...); }
+};
+//---------------------------------------------------------------------------
+/// Lazy elementwise application of op, evaluated when assigned to a Vec.
+/// Operands that are named Vecs are referenced, not copied. An expression kept in an auto variable dangles once one of them is destroyed and sees every later change of them,
+/// so Vecs are only built from temporary expressions and a stored one must be passed with std::move
+template <typename Op, typename... Args>
+class VecMap {
+    [[no_unique_address]] Op op;
+    std::tuple<Args...> args;
+
+    public:
+    explicit VecMap(Op op, Args... args) : op(op), args(std::forward<Args>(args)...) {}
+
+    num operator[](size_t i) const {
+        return std::apply([&](const auto&... a) { return op(vecdetail::getAt(a, i)...); }, args);
+    }
+    /// Scalars are broadcast, all other operands must have the same size
+    size_t size() const {
+        size_t result = 0;
+        [[maybe_unused]] bool first = true;
+        auto visit = [&](const auto& a) {
+            if constexpr (!std::is_arithmetic_v<std::remove_cvref_t<decltype(a)>>) {
+                assert(first || a.size() == result);
+                result = a.size();
+                first = false;
+            }
+        };
+        std::apply([&](const auto&... a) { (visit(a), ...); }, args);
+        return result;
+    }
+    num sum() const {
+        num result = 0;
+        for (size_t i = 0, n = size(); i < n; i++)
+            result += (*this)[i];
+        return result;
+    }
 };
 //---------------------------------------------------------------------------
 #define PHYSMAN_VEC_DEFOP(op, func) \
-static inline Vec op(Vec&& v1, Vec&& v2) { return Vec::apply(func, std::move(v1), std::move(v2)); } \
-static inline Vec op(Vec&& v1, const Vec& v2) { return Vec::apply(func, std::move(v1), v2); } \
-static inline Vec op(const Vec& v1, Vec&& v2) { return Vec::apply(func, v1, std::move(v2)); } \
-static inline Vec op(const Vec& v1, const Vec& v2) { return Vec::apply(func, v1, v2); } \
-static inline Vec op(Vec&& v1, num v2) { return Vec::apply(func, std::move(v1), v2); } \
-static inline Vec op(const Vec& v1, num v2) { return Vec::apply(func, v1, v2); } \
-static inline Vec op(num v1, Vec&& v2) { return Vec::apply(func, v1, std::move(v2)); } \
-static inline Vec op(num v1, const Vec& v2) { return Vec::apply(func, v1, v2); }
+template <VecOperand A, VecOperand B> requires(VecLike<A> || VecLike<B>) \
+inline auto op(A&& a, B&& b) { return Vec::apply(func, std::forward<A>(a), std::forward<B>(b)); }
 PHYSMAN_VEC_DEFOP(operator+, std::plus{})
 PHYSMAN_VEC_DEFOP(operator-, std::minus{})
 PHYSMAN_VEC_DEFOP(operator*, std::multiplies{})
 PHYSMAN_VEC_DEFOP(operator/, std::divides{})
 #undef PHYSMAN_VEC_DEFOP
 #define PHYSMAN_VEC_DEFOP(op, func) \
-inline Vec op(Vec&& v) { return Vec::apply(func, std::move(v)); } \
-inline Vec op(const Vec& v) { return Vec::apply(func, v); }
+template <VecLike A> \
+inline auto op(A&& a) { return Vec::apply(func, std::forward<A>(a)); }
 PHYSMAN_VEC_DEFOP(operator-, std::negate{});
 PHYSMAN_VEC_DEFOP(sqrt, [](num v) { return std::sqrt(v); });
 #undef PHYSMAN_VEC_DEFOP
 //---------------------------------------------------------------------------
+/// Sum of a[i] * b[i] in a single pass
+template <VecLike A, VecLike B>
+inline num dot(const A& a, const B& b) {
+    assert(a.size() == b.size());
+    if constexpr (std::same_as<A, Vec> && std::same_as<B, Vec>)
+        return simd::dot(a.data(), b.data(), a.size());
+    num result = 0;
+    for (size_t i = 0, n = a.size(); i < n; i++)
+        result += a[i] * b[i];
+    return result;
+}
+/// y += alpha * x in a single pass
+template <VecLike X>
+inline void axpy(num alpha, const X& x, Vec& y) {
+    assert(x.size() == y.size());
+    if constexpr (std::same_as<X, Vec>)
+        return simd::axpy(alpha, x.data(), y.data(), y.size());
+    for (size_t i = 0, n = y.size(); i < n; i++)
+        y[i] += alpha * x[i];
 }
-//---------------------------------------------------------------------------
\ No newline at end of file
+/// y = x + alpha * y in a single pass
+inline void aypx(num alpha, const Vec& x, Vec& y) {
+    assert(x.size() == y.size());
+    simd::aypx(alpha, x.data(), y.data(), y.size());
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------